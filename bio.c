@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -12,84 +12,400 @@
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * To keep more than one request at the disk, get locked
+//     buffers with bstart, which starts the read of a block not
+//     cached, or start writes with bwritestart; then wait for
+//     each with bwait, or for whichever is first with bwaitany.
 //
 // The implementation uses two state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_IO: the disk driver is reading or writing the buffer.
+//
+// Each hash bucket has its own lock, which covers the chain and
+// the refcnt of the buffers on it, so lookups of different
+// blocks on different CPUs do not serialize. A miss takes
+// bcache.lock, which serializes changes of identity, and
+// recycles a buffer chosen by a clock: a hand sweeps the ring
+// of all buffers, passing over (and clearing B_USED on) those
+// used since its last visit. Lock order: bcache.lock, then a
+// bucket lock; never two bucket locks at once.
+//
+// The cache starts with NBUF buffers and grows a page of
+// buffers at a time, from kalloc(), while more than a quarter
+// of memory is free; kalloc() calls bshrink() to take back
+// pages of clean, unreferenced buffers when memory runs out.
+// When every buffer is in use, bget() asks the log writer to
+// checkpoint (logpressure() in log.c) and waits for a brelse().
+// breserve() grows the cache at boot by the buffers the log
+// keeps pinned, and bshrink() leaves those. Buffers that hold
+// no block are on the chain of (BNODEV, 0).
+//
+// bprivate() hands out buffers that are not in the cache at all,
+// to the log writer, so that it never waits for a cache buffer.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
 
-struct {
+#define BNODEV 0xffffffff   // dev of a buffer holding no block
+
+struct bufpage {
+  struct bufpage *next;
+  struct buf buf[(PGSIZE - sizeof(struct bufpage*)) / sizeof(struct buf)];
+};
+#define BUFPERPG NELEM(((struct bufpage*)0)->buf)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf *head;      // chain through buf.next
+  uint hits;
+  uint misses;
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+struct {
+  struct spinlock lock;  // identity changes, ring, pages, nwait
+  struct buf buf[NBUF];
+  struct bufpage *pages; // added by bgrow()
+  struct buf *hand;      // clock hand on the ring through cnext
+  uint nbuf;
+  uint reserve;          // buffers bshrink() must leave, past NBUF
+  uint nwait;            // processes waiting in bget()
+  struct bucket bucket[NBHASH];
 } bcache;
 
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return &bcache.bucket[(dev*31 + blockno) % NBHASH];
+}
+
+// Add b, which holds no block, to the cache: on the ring just
+// before the hand, and on the chain for no block.
+// Caller must hold bcache.lock.
+static void
+badd(struct buf *b)
+{
+  struct bucket *k;
+
+  initsleeplock(&b->lock, "buffer");
+  b->dev = BNODEV;
+  b->blockno = 0;
+  if(bcache.hand == 0){
+    b->cnext = b->cprev = b;
+    bcache.hand = b;
+  } else {
+    b->cnext = bcache.hand;
+    b->cprev = bcache.hand->cprev;
+    b->cprev->cnext = b;
+    bcache.hand->cprev = b;
+  }
+  k = bhash(BNODEV, 0);
+  acquire(&k->lock);
+  b->next = k->head;
+  k->head = b;
+  release(&k->lock);
+  bcache.nbuf++;
+}
+
 void
 binit(void)
 {
   struct buf *b;
+  int i;
 
   initlock(&bcache.lock, "bcache");
+  for(i = 0; i < NBHASH; i++)
+    initlock(&bcache.bucket[i].lock, "bcache.bucket");
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  acquire(&bcache.lock);
+  for(b = bcache.buf; b < bcache.buf+NBUF; b++)
+    badd(b);
+  release(&bcache.lock);
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Add a page of buffers if memory is plentiful, with the hand
+// on the first of them. Returns 0 on success, -1 if not.
+// Caller must hold bcache.lock.
+static int
+bgrow(void)
+{
+  struct bufpage *pg;
+  uint nfree, npages;
+  int i;
+
+  kmemstat(&nfree, &npages);
+  if(nfree <= npages / 4)
+    return -1;
+  if((pg = (struct bufpage*)kalloc()) == 0)
+    return -1;
+  memset(pg, 0, PGSIZE);
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  for(i = 0; i < BUFPERPG; i++)
+    badd(&pg->buf[i]);
+  bcache.hand = &pg->buf[0];
+  return 0;
+}
+
+// Find block on device dev in bucket k and take a reference.
+// Caller must hold k->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+bfind(struct bucket *k, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = k->head; b != 0; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
 
-  // Not cached; recycle an unused buffer.
+// Take b off its chain if it is unused and clean; returns 0 on
+// success, -1 if b is busy. Caller must hold bcache.lock.
+static int
+bunhash(struct buf *b, int clock)
+{
+  struct buf **pp;
+  struct bucket *k;
+
+  k = bhash(b->dev, b->blockno);
+  acquire(&k->lock);
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
+  if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+    release(&k->lock);
+    return -1;
+  }
+  if(clock && (b->flags & B_USED)){
+    b->flags &= ~B_USED;
+    release(&k->lock);
+    return -1;
+  }
+  for(pp = &k->head; *pp != b; pp = &(*pp)->next)
+    ;
+  *pp = b->next;
+  release(&k->lock);
+  return 0;
+}
+
+// Take an unused clean buffer off its chain for reuse, from a
+// new page if memory allows, else one the clock picks, in two
+// sweeps at most. Caller must hold bcache.lock.
+static struct buf*
+brecycle(void)
+{
+  struct buf *b;
+  int n;
+
+  if(bcache.hand->dev != BNODEV)
+    bgrow();
+  for(n = 0; n < 2*bcache.nbuf; n++){
+    b = bcache.hand;
+    bcache.hand = b->cnext;
+    if(bunhash(b, 1) == 0)
+      return b;
+  }
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer, waiting for one to be
+// released if all are in use, unless nowait, in which case
+// return 0. Returns the buffer with a reference but unlocked.
+// Only lookups on behalf of a reader (not read-ahead) count as
+// hits; those are the ones with hit set.
+static struct buf*
+bget1(uint dev, uint blockno, int nowait, int hit)
+{
+  struct bucket *k;
+  struct buf *b;
+  int waiting;
+
+  k = bhash(dev, blockno);
+  acquire(&k->lock);
+  if((b = bfind(k, dev, blockno)) != 0 && hit)
+    k->hits++;
+  release(&k->lock);
+  if(b)
+    return b;
+
+  // Not cached. Only holders of bcache.lock add blocks, so if
+  // the block is still missing with it held, it stays missing.
+  // If no buffer is free, wait for a brelse(), announcing it
+  // in nwait before the last look, so that the wakeup of a
+  // brelse() during the look is not missed.
+  acquire(&bcache.lock);
+  waiting = 0;
+  for(;;){
+    acquire(&k->lock);
+    if((b = bfind(k, dev, blockno)) != 0 && hit)
+      k->hits++;
+    release(&k->lock);
+    if(b)
+      break;
+    if((b = brecycle()) != 0){
       b->dev = dev;
       b->blockno = blockno;
       b->flags = 0;
       b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+      acquire(&k->lock);
+      b->next = k->head;
+      k->head = b;
+      k->misses++;
+      release(&k->lock);
+      break;
+    }
+    if(nowait)
+      break;
+    if(waiting){
+      logpressure();
+      sleep(&bcache.nwait, &bcache.lock);
+    }
+    else {
+      waiting = 1;
+      bcache.nwait++;
+    }
+  }
+  if(waiting)
+    bcache.nwait--;
+  release(&bcache.lock);
+  return b;
+}
+
+// Return a locked buffer for block on device dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget1(dev, blockno, 0, 1);
+  acquiresleep(&b->lock);
+  return b;
+}
+
+// Put b, taken off its chain by bunhash(), back on it, still
+// holding its block: no one else can have cached the block
+// meanwhile. Caller must hold bcache.lock.
+static void
+brehash(struct buf *b)
+{
+  struct bucket *k;
+
+  k = bhash(b->dev, b->blockno);
+  acquire(&k->lock);
+  b->next = k->head;
+  k->head = b;
+  release(&k->lock);
+}
+
+// Free a page of buffers that are all unused and clean, for
+// kalloc() when memory runs out. Returns 0 if a page was freed,
+// -1 if none could be. Must not be called with spin locks held.
+int
+bshrink(void)
+{
+  struct bufpage *pg, **pp;
+  struct buf *b;
+  int i, j;
+
+  acquire(&bcache.lock);
+  if(bcache.nbuf < NBUF + bcache.reserve + BUFPERPG){
+    release(&bcache.lock);
+    return -1;
+  }
+  for(pp = &bcache.pages; (pg = *pp) != 0; pp = &pg->next){
+    for(i = 0; i < BUFPERPG; i++)
+      if(bunhash(&pg->buf[i], 0) < 0)
+        break;
+    if(i == BUFPERPG)
+      break;
+    // One is busy: the others keep their blocks.
+    for(j = 0; j < i; j++)
+      brehash(&pg->buf[j]);
+  }
+  if(pg == 0){
+    release(&bcache.lock);
+    return -1;
+  }
+  *pp = pg->next;
+  for(i = 0; i < BUFPERPG; i++){
+    b = &pg->buf[i];
+    b->cnext->cprev = b->cprev;
+    b->cprev->cnext = b->cnext;
+    if(bcache.hand == b)
+      bcache.hand = b->cnext;
+  }
+  bcache.nbuf -= BUFPERPG;
+  release(&bcache.lock);
+  kfree((char*)pg);
+  return 0;
+}
+
+// Grow the cache by n buffers, for good: bshrink() leaves them.
+// For blocks that the log keeps pinned; called at boot, when
+// memory is plentiful.
+void
+breserve(int n)
+{
+  acquire(&bcache.lock);
+  bcache.reserve += n;
+  while(bcache.nbuf < NBUF + bcache.reserve)
+    if(bgrow() < 0)
+      panic("breserve");
+  release(&bcache.lock);
+}
+
+// Allocate n buffers that are not in the cache, into bs, and
+// lock them for good. The caller sets their dev and blockno and
+// uses them only with bwrite(), bwritestart() and bwait(), as
+// no one else can look them up.
+void
+bprivate(struct buf **bs, int n)
+{
+  struct bufpage *pg;
+  int i;
+
+  pg = 0;
+  for(i = 0; i < n; i++){
+    if(i % BUFPERPG == 0){
+      if((pg = (struct bufpage*)kalloc()) == 0)
+        panic("bprivate");
+      memset(pg, 0, PGSIZE);
     }
+    bs[i] = &pg->buf[i % BUFPERPG];
+    initsleeplock(&bs[i]->lock, "private buffer");
+    acquiresleep(&bs[i]->lock);
+  }
+}
+
+// Drop a reference to b, waking anyone waiting in bget() for
+// a free buffer if it was the last.
+static void
+bunref(struct buf *b)
+{
+  struct bucket *k;
+  uint n;
+
+  k = bhash(b->dev, b->blockno);
+  acquire(&k->lock);
+  n = --b->refcnt;
+  release(&k->lock);
+  if(n == 0 && bcache.nwait){
+    acquire(&bcache.lock);
+    wakeup(&bcache.nwait);
+    release(&bcache.lock);
   }
-  panic("bget: no buffers");
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -105,6 +421,42 @@ bread(uint dev, uint blockno)
   return b;
 }
 
+// Return a locked buf for a block whose every byte the caller
+// is about to write, without reading the old contents.
+struct buf*
+bnew(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno);
+  b->flags |= B_VALID;
+  return b;
+}
+
+// Like bread, but return as soon as the read is started; the
+// contents are not there until bwait() or bwaitany() says so.
+// If nowait, return 0 rather than wait for a free buffer or for
+// another process to release the block, as a caller already
+// holding buffers must, lest it wait for one of its own.
+struct buf*
+bstart(uint dev, uint blockno, int nowait)
+{
+  struct buf *b;
+
+  if(nowait){
+    if((b = bget1(dev, blockno, 1, 1)) == 0)
+      return 0;
+    if(!tryacquiresleep(&b->lock)){
+      bunref(b);
+      return 0;
+    }
+  } else
+    b = bget(dev, blockno);
+  if((b->flags & B_VALID) == 0)
+    idesubmit(b);
+  return b;
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,30 +467,128 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Start writing b's contents to disk and return; b must stay
+// locked, and untouched, until bwait() or bwaitany() returns it.
+void
+bwritestart(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwritestart");
+  b->flags |= B_DIRTY;
+  idesubmit(b);
+}
+
+// Wait for the read or write started on b to finish.
+void
+bwait(struct buf *b)
+{
+  ideiowait(b);
+}
+
+// Wait for any of the n buffers in bs, skipping null entries,
+// to finish its read or write, and return it.
+struct buf*
+bwaitany(struct buf **bs, int n)
+{
+  return ideiowaitany(bs, n);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Mark it used, so the clock passes it over once.
 void
 brelse(struct buf *b)
 {
   if(!holdingsleep(&b->lock))
     panic("brelse");
 
+  b->flags |= B_USED;
+  releasesleep(&b->lock);
+  bunref(b);
+}
+
+// Start reading the indicated block into the cache, unless it
+// is there already or every buffer is in use, and return
+// without waiting for the disk. A later bread() of the block
+// sleeps on the buffer lock until the read is done.
+void
+breadahead(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget1(dev, blockno, 1, 0)) == 0)
+    return;
+  if(b->refcnt > 1 || (b->flags & B_VALID)){
+    // Cached, or being read or used by someone else.
+    bunref(b);
+    return;
+  }
+  // Most likely a new buffer. If another process found it
+  // first, it is reading the block itself, and holds the lock
+  // until it has.
+  acquiresleep(&b->lock);
+  if(b->flags & B_VALID){
+    releasesleep(&b->lock);
+    bunref(b);
+    return;
+  }
+  b->iodone = biodone;
+  idesubmit(b);
+}
+
+// Called by the disk driver when a read started by
+// breadahead() is done.
+void
+biodone(struct buf *b)
+{
   releasesleep(&b->lock);
+  bunref(b);
+}
+
+// Forget every cached block that is unused and clean, and give
+// the buffer pages back, so that the next reads go to disk.
+void
+bdrop(void)
+{
+  struct buf *b;
+  struct bucket *k;
+  int n;
 
   acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
-  
+  k = bhash(BNODEV, 0);
+  b = bcache.hand;
+  for(n = 0; n < bcache.nbuf; n++, b = b->cnext){
+    if(b->dev == BNODEV || bunhash(b, 0) < 0)
+      continue;
+    b->dev = BNODEV;
+    b->blockno = 0;
+    b->flags = 0;
+    acquire(&k->lock);
+    b->next = k->head;
+    k->head = b;
+    release(&k->lock);
+  }
   release(&bcache.lock);
+  while(bshrink() == 0)
+    ;
+}
+
+// Report the number of buffers and the lookups that found
+// their block cached and that did not.
+void
+bstat(uint *nbuf, uint *hits, uint *misses)
+{
+  int i;
+
+  acquire(&bcache.lock);
+  *nbuf = bcache.nbuf;
+  release(&bcache.lock);
+  *hits = *misses = 0;
+  for(i = 0; i < NBHASH; i++){
+    acquire(&bcache.bucket[i].lock);
+    *hits += bcache.bucket[i].hits;
+    *misses += bcache.bucket[i].misses;
+    release(&bcache.bucket[i].lock);
+  }
 }
 //PAGEBREAK!
 // Blank page.
-
@@ -4,11 +4,15 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
-  struct buf *next;
+  struct buf *next; // hash chain
+  struct buf *cnext; // recycling clock ring
+  struct buf *cprev;
   struct buf *qnext; // disk queue
+  void (*iodone)(struct buf*); // called when an idesubmit() is over
   uchar data[BSIZE];
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
+#define B_USED  0x8  // used since the recycling clock last passed
+#define B_IO    0x10 // transfer to or from disk in flight
 
@@ -0,0 +1,103 @@
+// Parallel reads through the buffer cache.
+//
+//   catbench [nproc] [passes]
+//
+// Writes nproc files (default 4) of FILEKB Kbytes each, then
+// times reading all of them passes times (default 20), first
+// one after the other in a single process and then with one
+// process per file, as if by nproc cats at once. With more
+// CPUs than 1 (make CPUS=4 qemu), the parallel run shows how
+// much the readers serialize in the buffer cache. Run it in
+// kernels built with make NBUF=30 and NBUF=1024 to compare a
+// cache smaller than the files with one that holds them.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define FILEKB 48
+#define MAXPROC 8
+
+char buf[1024];
+
+void
+name(char *s, int i)
+{
+  strcpy(s, "catbench.0");
+  s[9] = '0' + i;
+}
+
+void
+catfile(int i, int passes)
+{
+  char path[16];
+  int fd, n, total;
+
+  name(path, i);
+  while(passes-- > 0){
+    if((fd = open(path, O_RDONLY)) < 0){
+      printf(2, "catbench: cannot open %s\n", path);
+      exit();
+    }
+    total = 0;
+    while((n = read(fd, buf, sizeof(buf))) > 0)
+      total += n;
+    close(fd);
+    if(total != FILEKB*1024){
+      printf(2, "catbench: read %d bytes of %s\n", total, path);
+      exit();
+    }
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16];
+  int i, j, fd, nproc, passes, t0, t1, t2;
+
+  nproc = argc >= 2 ? atoi(argv[1]) : 4;
+  passes = argc >= 3 ? atoi(argv[2]) : 20;
+  if(nproc < 1 || nproc > MAXPROC){
+    printf(2, "catbench: 1 to %d processes\n", MAXPROC);
+    exit();
+  }
+  memset(buf, 'c', sizeof(buf));
+  for(i = 0; i < nproc; i++){
+    name(path, i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf(2, "catbench: cannot create %s\n", path);
+      exit();
+    }
+    for(j = 0; j < FILEKB; j++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(2, "catbench: write failed\n");
+        exit();
+      }
+    close(fd);
+  }
+
+  t0 = uptime();
+  for(i = 0; i < nproc; i++)
+    catfile(i, passes);
+  t1 = uptime();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      catfile(i, passes);
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  t2 = uptime();
+
+  printf(1, "catbench: %d files of %d Kbytes read %d times: "
+         "serial %d ticks, %d in parallel %d ticks\n",
+         nproc, FILEKB, passes, t1 - t0, nproc, t2 - t1);
+  for(i = 0; i < nproc; i++){
+    name(path, i);
+    unlink(path);
+  }
+  exit();
+}
@@ -236,7 +236,7 @@ int
 consoleread(struct inode *ip, char *dst, int n)
 {
   uint target;
-  int c;
+  char c;
 
   iunlock(ip);
   target = n;
@@ -259,7 +259,12 @@ consoleread(struct inode *ip, char *dst, int n)
       }
       break;
     }
-    *dst++ = c;
+    if(ucopy(dst++, &c, 1) < 0){
+      input.r--;
+      release(&cons.lock);
+      ilock(ip);
+      return -1;
+    }
     --n;
     if(c == '\n')
       break;
@@ -274,15 +279,16 @@ int
 consolewrite(struct inode *ip, char *buf, int n)
 {
   int i;
+  char c;
 
   iunlock(ip);
   acquire(&cons.lock);
-  for(i = 0; i < n; i++)
-    consputc(buf[i] & 0xff);
+  for(i = 0; i < n && ucopy(&c, buf + i, 1) == 0; i++)
+    consputc(c & 0xff);
   release(&cons.lock);
   ilock(ip);
 
-  return n;
+  return i < n ? -1 : n;
 }
 
 void
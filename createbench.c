@@ -0,0 +1,146 @@
+// Small-file creation from several processes, for the log.
+//
+//   createbench [nproc [nfile]]
+//
+// nproc processes (default 4) each create nfile files (default
+// 100) of one block in a directory of their own, then remove
+// them. Prints the time taken, files created per second, the
+// disk blocks written per 1000 files, and the log commits and
+// checkpoints, for each phase. The system calls of processes
+// that run together share log commits, so the more processes,
+// the fewer writes each file costs. Build the kernel with make
+// LOGDEFER=0 to write every commit's blocks home at once.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "meminfo.h"
+
+#define MAXPROC 8
+
+char buf[BSIZE];
+struct meminfo m0;
+int t0;
+
+void
+name(char *s, int p, int i)
+{
+  strcpy(s, "cb0/f000");
+  s[2] = '0' + p;
+  s[5] = '0' + i/100%10;
+  s[6] = '0' + i/10%10;
+  s[7] = '0' + i%10;
+}
+
+void
+start(void)
+{
+  meminfo(&m0);
+  t0 = uptime();
+}
+
+void
+report(char *what, int nfile)
+{
+  struct meminfo m1;
+  int t, w;
+
+  t = uptime() - t0;
+  meminfo(&m1);
+  w = m1.diskwrites - m0.diskwrites;
+  printf(1, "%s: %d files, %d ticks, ", what, nfile, t);
+  if(t > 0)
+    printf(1, "%d files/s, ", nfile*100/t);
+  else
+    printf(1, "- files/s, ");
+  printf(1, "%d blocks written, %d per 1000 files, "
+         "%d commits, %d checkpoints\n", w, w*1000/nfile,
+         m1.logcommits - m0.logcommits, m1.logckpts - m0.logckpts);
+}
+
+// Run f(p, nfile) in nproc processes at once.
+void
+together(int nproc, int nfile, void (*f)(int, int))
+{
+  int p;
+
+  for(p = 0; p < nproc; p++){
+    if(fork() == 0){
+      f(p, nfile);
+      exit();
+    }
+  }
+  for(p = 0; p < nproc; p++)
+    wait();
+}
+
+void
+create(int p, int nfile)
+{
+  char path[16];
+  int i, fd;
+
+  for(i = 0; i < nfile; i++){
+    name(path, p, i);
+    if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+      printf(2, "createbench: cannot create %s\n", path);
+      exit();
+    }
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(2, "createbench: write failed\n");
+      exit();
+    }
+    close(fd);
+  }
+}
+
+void
+remove(int p, int nfile)
+{
+  char path[16];
+  int i;
+
+  for(i = 0; i < nfile; i++){
+    name(path, p, i);
+    unlink(path);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16];
+  int p, nproc, nfile;
+
+  nproc = argc >= 2 ? atoi(argv[1]) : 4;
+  nfile = argc >= 3 ? atoi(argv[2]) : 100;
+  if(nproc < 1 || nproc > MAXPROC || nfile < 1 || nfile > 1000){
+    printf(2, "createbench: 1 to %d processes, 1 to 1000 files\n", MAXPROC);
+    exit();
+  }
+  memset(buf, 'c', sizeof(buf));
+  for(p = 0; p < nproc; p++){
+    name(path, p, 0);
+    path[3] = 0;
+    if(mkdir(path) < 0){
+      printf(2, "createbench: cannot make %s\n", path);
+      exit();
+    }
+  }
+
+  start();
+  together(nproc, nfile, create);
+  report("create", nproc*nfile);
+  start();
+  together(nproc, nfile, remove);
+  report("unlink", nproc*nfile);
+
+  for(p = 0; p < nproc; p++){
+    name(path, p, 0);
+    path[3] = 0;
+    unlink(path);
+  }
+  exit();
+}
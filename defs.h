@@ -1,10 +1,13 @@
 struct buf;
+struct pcidev;
 struct context;
 struct file;
 struct inode;
 struct pipe;
 struct proc;
+struct procmem;
 struct rtcdate;
+struct shm;
 struct spinlock;
 struct sleeplock;
 struct stat;
@@ -14,7 +17,19 @@ struct superblock;
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            biodone(struct buf*);
+void            bdrop(void);
+void            breadahead(uint, uint);
+struct buf*     bnew(uint, uint);
+void            bprivate(struct buf**, int);
+void            breserve(int);
+int             bshrink(void);
+struct buf*     bstart(uint, uint, int);
+void            bstat(uint*, uint*, uint*);
+void            bwait(struct buf*);
+struct buf*     bwaitany(struct buf**, int);
 void            bwrite(struct buf*);
+void            bwritestart(struct buf*);
 
 // console.c
 void            consoleinit(void);
@@ -49,14 +64,27 @@ void            iupdate(struct inode*);
 int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
+int             readahead(int);
 int             readi(struct inode*, char*, uint, uint);
+uint            ireadahead(struct inode*, uint, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
+// futex.c
+void            futexinit(void);
+int             futexwait(int*, int);
+int             futexwake(int*, int);
+
 // ide.c
+extern struct spinlock idelock;
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            idedone(struct buf**, int);
+void            idestat(uint*, uint*, uint*, uint*, uint*);
+void            idesubmit(struct buf*);
+void            ideiowait(struct buf*);
+struct buf*     ideiowaitany(struct buf**, int);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -65,9 +93,18 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kallocpages(int);
+void            kbuddystat(uint*);
 void            kfree(char*);
+void            kfreepages(char*, int);
+void            kincref(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemlimit(uint);
+void            kmemstat(uint*, uint*);
+int             krefcount(char*);
+char*           ksuperalloc(void);
+void            ksuperfree(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -78,12 +115,15 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(uchar, int);
 void            lapicstartap(uchar, uint);
 void            microdelay(int);
 
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            logpressure(void);
+void            logstat(uint*, uint*, uint*, uint*);
 void            begin_op();
 void            end_op();
 
@@ -91,6 +131,11 @@ void            end_op();
 extern int      ismp;
 void            mpinit(void);
 
+// pci.c
+int             pcifind(uint, uint, uint, uint, struct pcidev*);
+uint            pciread(struct pcidev*, uint);
+void            pciwrite(struct pcidev*, uint, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -101,26 +146,57 @@ void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
 int             pipewrite(struct pipe*, char*, int);
 
+// pagecache.c
+void            pcinit(void);
+char*           pcget(struct inode*, uint, uint, int);
+void            pcinval(struct inode*);
+int             pcread(struct inode*, char*, uint, uint);
+int             pcwrite(struct inode*, char*, uint, uint);
+void            pcstat(uint*, uint*, uint*);
+
 //PAGEBREAK: 16
 // proc.c
+int             clone(void(*)(void*), void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
 int             growproc(int);
+int             join(void**);
 int             kill(int);
+int             kproc(char*, void(*)(void*), void*);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+int             procmem(struct procmem*, int);
+void            replacevm(pde_t*, uint);
+int             rsslimit(int, int);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+char*           swapvictim(uint);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
 void            yield(void);
 
+// shm.c
+void            shminit(void);
+struct shm*     shmget(char*, uint);
+void            shmdup(struct shm*);
+void            shmput(struct shm*);
+uint            shmsize(struct shm*);
+char*           shmpage(struct shm*, uint);
+
+// swap.c
+void            swapinit(int);
+void            swapin(uint, char*);
+int             swapout(void);
+void            swapdup(uint);
+void            swapput(uint);
+void            swapstat(uint*, uint*, uint*, uint*);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -137,6 +213,7 @@ void            popcli(void);
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
 int             holdingsleep(struct sleeplock*);
+int             tryacquiresleep(struct sleeplock*);
 void            initsleeplock(struct sleeplock*, char*);
 
 // string.c
@@ -151,9 +228,10 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
-int             argstr(int, char**);
+int             argptrw(int, char**, int);
+int             argstr(int, char*, int);
 int             fetchint(uint, int*);
-int             fetchstr(uint, char**);
+int             fetchstr(uint, char*, int);
 void            syscall(void);
 
 // timer.c
@@ -165,26 +243,53 @@ extern uint     ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
+// trapasm.S
+int             ucopy(void*, const void*, uint);
+
 // uart.c
 void            uartinit(void);
 void            uartintr(void);
 void            uartputc(int);
 
+// virtio.c
+extern int      virtioirq;
+int             virtioinit(void);
+void            virtiointr(void);
+void            virtiostart(struct buf*);
+void            virtiostat(uint*, uint*, uint*, uint64*);
+
 // vm.c
 void            seginit(void);
 void            kvmalloc(void);
 pde_t*          setupkvm(void);
 char*           uva2ka(pde_t*, char*);
 int             allocuvm(pde_t*, uint, uint);
+int             allocsuvm(pde_t*, uint, uint);
+int             zerouvm(pde_t*, uint, uint);
 int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
-int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
 pde_t*          copyuvm(pde_t*, uint);
 void            switchuvm(struct proc*);
+void            uvmflush(pde_t*);
+void            lockuvm(pde_t*);
+void            unlockuvm(pde_t*);
 void            switchkvm(void);
+void            switchtss(struct proc*);
 int             copyout(pde_t*, uint, void*, uint);
-void            clearpteu(pde_t *pgdir, char *uva);
+void            vmainit(void);
+int             vmaalloc(pde_t*, uint, uint, int, struct inode*, uint, uint);
+int             vmacopy(pde_t*, pde_t*);
+void            vmaclear(pde_t*);
+int             pagefault(uint, uint);
+int             uvmtouch(uint, uint, int);
+char*           uvmevict(pde_t*, uint, uint*, uint);
+void            uvmstat(pde_t*, struct procmem*);
+int             mmapuvm(struct inode*, struct shm*, uint, uint, int);
+int             munmapuvm(uint, uint);
+int             shmdetach(uint);
+int             vmammapped(pde_t*, uint, uint);
+void            vmawriteback(pde_t*, uint, uint);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
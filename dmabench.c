@@ -0,0 +1,82 @@
+// CPU time the disk driver spends per Mbyte moved.
+//
+//   dmabench [runs]
+//
+// Writes a file as large as the file system allows, then reads
+// it runs times (default 5) from an empty buffer cache, and
+// prints the time taken and the CPU time the driver spent, in
+// thousands of cycles per Mbyte. Build the kernel with make
+// IDEDMA=0 to compare programmed I/O with bus-master DMA, or run
+// it under make qemu-virtio to compare both with virtio-blk.
+// Needs a kernel built with make DROPCACHE=1.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "meminfo.h"
+
+#define FILENAME "dmabench.tmp"
+#define FILEBYTES (MAXFILE*BSIZE)
+
+char buf[4096];
+
+void
+report(char *what, struct meminfo *m0, struct meminfo *m1, uint kb, int t)
+{
+  uint kc;
+
+  // diskcpu is in units of 1024 cycles.
+  kc = (m1->diskcpu - m0->diskcpu) * 1024 / 1000;
+  printf(1, "%s: %d blocks in %d commands, %d ticks, %d Kcycles, "
+         "%d Kcycles/Mbyte\n", what,
+         m1->diskreads - m0->diskreads + m1->diskwrites - m0->diskwrites,
+         m1->diskcmds - m0->diskcmds, t, kc, kc*1024/kb);
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct meminfo m0, m1;
+  int i, fd, runs, t0, n, total;
+
+  runs = argc >= 2 ? atoi(argv[1]) : 5;
+  memset(buf, 'd', sizeof(buf));
+  meminfo(&m0);
+  t0 = uptime();
+  if((fd = open(FILENAME, O_CREATE|O_RDWR)) < 0){
+    printf(2, "dmabench: cannot create %s\n", FILENAME);
+    exit();
+  }
+  for(total = 0; total < FILEBYTES; total += n){
+    n = FILEBYTES - total < sizeof(buf) ? FILEBYTES - total : sizeof(buf);
+    if(write(fd, buf, n) != n){
+      printf(2, "dmabench: write failed\n");
+      exit();
+    }
+  }
+  close(fd);
+  meminfo(&m1);
+  report("write", &m0, &m1, FILEBYTES/1024, uptime() - t0);
+
+  meminfo(&m0);
+  t0 = uptime();
+  for(i = 0; i < runs; i++){
+    if(dropcache() < 0){
+      printf(2, "dmabench: dropcache failed; build with DROPCACHE=1\n");
+      exit();
+    }
+    if((fd = open(FILENAME, O_RDONLY)) < 0){
+      printf(2, "dmabench: cannot open %s\n", FILENAME);
+      exit();
+    }
+    while(read(fd, buf, sizeof(buf)) > 0)
+      ;
+    close(fd);
+  }
+  meminfo(&m1);
+  report("read", &m0, &m1, runs*FILEBYTES/1024, uptime() - t0);
+  unlink(FILENAME);
+  exit();
+}
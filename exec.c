@@ -6,6 +6,7 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "vma.h"
 
 int
 exec(char *path, char **argv)
@@ -16,7 +17,7 @@ exec(char *path, char **argv)
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
-  pde_t *pgdir, *oldpgdir;
+  pde_t *pgdir;
   struct proc *curproc = myproc();
 
   begin_op();
@@ -38,7 +39,8 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Map program segments; pages are read in by pagefault()
+  // the first time they are touched.
   sz = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
@@ -49,23 +51,34 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
-    if(ph.vaddr % PGSIZE != 0)
+    if(ph.vaddr % PGSIZE != 0 || ph.vaddr < sz)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(ph.memsz == 0)
+      continue;
+    if(vmaalloc(pgdir, ph.vaddr, ph.vaddr + ph.memsz,
+                (ph.flags & ELF_PROG_FLAG_WRITE) ? VMA_WRITE : 0,
+                ip, ph.off, ph.filesz) < 0)
       goto bad;
+    sz = ph.vaddr + ph.memsz;
   }
   iunlockput(ip);
   end_op();
   ip = 0;
 
-  // Allocate two pages at the next page boundary.
-  // Make the first inaccessible.  Use the second as the user stack.
-  sz = PGROUNDUP(sz);
-  if((sz = allocuvm(pgdir, sz, sz + 2*PGSIZE)) == 0)
+  // Leave an unmapped guard page at the next page boundary,
+  // then MAXUSTACK pages of stack. Only the top page is
+  // allocated now; the rest is a zero-filled region that
+  // pagefault() maps as the stack grows down into it. Running
+  // off the bottom hits the guard page and kills the process.
+  sz = PGROUNDUP(sz) + PGSIZE;
+  if(vmaalloc(pgdir, sz, sz + (MAXUSTACK-1)*PGSIZE, VMA_WRITE,
+              0, 0, 0) < 0)
+    goto bad;
+  sz += (MAXUSTACK-1)*PGSIZE;
+  if((sz = allocuvm(pgdir, sz, sz + PGSIZE)) == 0)
     goto bad;
-  clearpteu(pgdir, (char*)(sz - 2*PGSIZE));
   sp = sz;
 
   // Push argument strings, prepare rest of stack in ustack.
@@ -94,21 +107,20 @@ exec(char *path, char **argv)
   safestrcpy(curproc->name, last, sizeof(curproc->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
-  switchuvm(curproc);
-  freevm(oldpgdir);
+  replacevm(pgdir, sz);
   return 0;
 
  bad:
-  if(pgdir)
-    freevm(pgdir);
-  if(ip){
+  if(ip)
     iunlockput(ip);
-    end_op();
+  else
+    begin_op();
+  if(pgdir){
+    vmaclear(pgdir);
+    freevm(pgdir);
   }
+  end_op();
   return -1;
 }
@@ -2,3 +2,12 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+// mmap() protection
+#define PROT_READ   0x1
+#define PROT_WRITE  0x2
+
+// mmap() flags: exactly one of MAP_SHARED and MAP_PRIVATE
+#define MAP_SHARED  0x1   // writes go to the file and to other mappers
+#define MAP_PRIVATE 0x2   // writes stay in this process
+#define MAP_ANON    0x4   // zero-filled memory, no file
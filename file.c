@@ -104,8 +104,16 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
+    // A read that carries on from the last one is taken to be
+    // sequential: start reading its blocks, and some beyond,
+    // before waiting for the first.
+    if(f->off == f->raoff)
+      f->rablock = ireadahead(f->ip, f->off, n, f->rablock);
+    else
+      f->rablock = 0;
     if((r = readi(f->ip, addr, f->off, n)) > 0)
       f->off += r;
+    f->raoff = f->off;
     iunlock(f->ip);
     return r;
   }
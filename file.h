@@ -6,6 +6,8 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;   // where the last read ended
+  uint rablock; // read-ahead started up to this block
 };
 
 
@@ -14,6 +16,7 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  int nshared;        // writable MAP_SHARED mappings (vm.c)
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
 
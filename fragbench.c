@@ -0,0 +1,99 @@
+// Physical memory fragmentation under fork/exit churn.
+//
+//   fragbench [rounds]
+//
+// Each round forks NCHILD children that grow their heaps by a
+// random number of pages; the first stays alive, holding its
+// memory, until the end. The free block counts of the page
+// allocator are printed before the churn, with the holders still
+// alive, and after they have exited.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define NCHILD 8
+#define NORDER 11
+
+uint seed = 1;
+
+int
+rand(void)
+{
+  seed = seed * 1103515245 + 12345;
+  return (seed >> 16) & 0x7fff;
+}
+
+void
+report(char *when)
+{
+  struct meminfo mi;
+  int i, big, largest;
+
+  meminfo(&mi);
+  printf(1, "%s: %d free pages; blocks of 2^0..2^10 pages:", when,
+         mi.freepages);
+  largest = 0;
+  for(i = 0; i < NORDER; i++){
+    printf(1, " %d", mi.freeblocks[i]);
+    if(mi.freeblocks[i])
+      largest = i;
+  }
+  big = mi.freeblocks[NORDER-1] << (NORDER-1);
+  printf(1, "\n%s: largest block 2^%d pages, %d%% of free memory in "
+         "4-Mbyte blocks\n", when, largest,
+         mi.freepages ? big * 100 / mi.freepages : 0);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, j, n, pid, rounds, nholders, nkids, fds[2], t0;
+  char c, *p;
+
+  rounds = argc >= 2 ? atoi(argv[1]) : 40;
+  if(pipe(fds) < 0){
+    printf(2, "fragbench: pipe failed\n");
+    exit();
+  }
+  report("before");
+  t0 = uptime();
+  nholders = 0;
+  for(i = 0; i < rounds; i++){
+    nkids = 0;
+    for(j = 0; j < NCHILD; j++){
+      n = 1 + rand() % 64;
+      if((pid = fork()) == 0){
+        close(fds[1]);
+        p = sbrk(n*4096);
+        if(p != (char*)-1)
+          memset(p, j, n*4096);
+        // The holder waits for the write end to close.
+        if(j == 0)
+          read(fds[0], &c, 1);
+        exit();
+      }
+      if(pid < 0)
+        break;
+      if(j == 0)
+        nholders++;
+      else
+        nkids++;
+    }
+    while(nkids-- > 0)
+      wait();
+    if(j == 0){
+      printf(2, "fragbench: out of processes after %d rounds\n", i);
+      break;
+    }
+  }
+  report("churned");
+  close(fds[1]);
+  for(i = 0; i < nholders; i++)
+    wait();
+  report("after");
+  printf(1, "fragbench: %d rounds of %d forks in %d ticks\n", rounds,
+         NCHILD, uptime() - t0);
+  exit();
+}
@@ -22,6 +22,7 @@
 #include "file.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
+#define max(a, b) ((a) > (b) ? (a) : (b))
 static void itrunc(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
@@ -432,6 +433,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcinval(ip);
 }
 
 // Copy stat information from inode.
@@ -452,8 +454,10 @@ stati(struct inode *ip, struct stat *st)
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
+  uint tot, m, bn, nb, i, j, start, end;
+  uint addr[RIBATCH];
+  struct buf *bp[RIBATCH], *b;
+  int r;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -467,14 +471,89 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
-    m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(dst, bp->data + off%BSIZE, m);
-    brelse(bp);
+    // Pages of a file mapped shared and writable may hold stores
+    // not yet on disk; read those from the page, and the others
+    // a page at a time.
+    if(ip->nshared > 0 && (r = pcread(ip, dst, off, n - tot)) != 0){
+      if(r < 0)
+        return -1;
+      m = r;
+      continue;
+    }
+    // Start the reads of up to RIBATCH blocks, so that the disk
+    // has them all at once, then copy each out as it comes in.
+    // Map the blocks first: bmap() may wait for a buffer.
+    m = min(n - tot, RIBATCH*BSIZE - off%BSIZE);
+    if(ip->nshared > 0)
+      m = min(m, PGSIZE - off%PGSIZE);
+    bn = off/BSIZE;
+    nb = (off%BSIZE + m + BSIZE-1) / BSIZE;
+    for(i = 0; i < nb; i++)
+      addr[i] = bmap(ip, bn + i);
+    for(i = 0; i < nb; i++)
+      if((bp[i] = bstart(ip->dev, addr[i], i > 0)) == 0)
+        break;
+    if(i < nb){
+      // Out of buffers; make do with those we have.
+      nb = i;
+      m = nb*BSIZE - off%BSIZE;
+    }
+    r = 0;
+    for(i = 0; i < nb; i++){
+      b = bwaitany(bp, nb);
+      for(j = 0; bp[j] != b; j++)
+        ;
+      start = max(off, (bn + j)*BSIZE);
+      end = min(off + m, (bn + j + 1)*BSIZE);
+      if(ucopy(dst + (start - off), b->data + start%BSIZE, end - start) < 0)
+        r = -1;
+      bp[j] = 0;
+      brelse(b);
+    }
+    if(r < 0)
+      return -1;
   }
   return n;
 }
 
+// Blocks of read-ahead for sequential reads; see readahead().
+int rawindow = RAWINDOW;
+
+// Start reading the blocks of ip that hold [off, off+n), and
+// rawindow blocks after them, into the buffer cache without
+// waiting, except those below block done, which an earlier call
+// has started. Returns the block after the last one started.
+// Caller must hold ip->lock.
+uint
+ireadahead(struct inode *ip, uint off, uint n, uint done)
+{
+  uint bn, end, nblocks;
+
+  if(ip->type == T_DEV || rawindow == 0 || off >= ip->size)
+    return done;
+  if(n > ip->size - off)
+    n = ip->size - off;
+  nblocks = (ip->size + BSIZE - 1) / BSIZE;
+  end = min((off + n + BSIZE - 1) / BSIZE + rawindow, nblocks);
+  for(bn = off / BSIZE > done ? off / BSIZE : done; bn < end; bn++)
+    breadahead(ip->dev, bmap(ip, bn));
+  return end > done ? end : done;
+}
+
+// Set the read-ahead window to n blocks, 0 to turn read-ahead
+// off; if n is negative, leave it as it is. Returns the old
+// window.
+int
+readahead(int n)
+{
+  int old;
+
+  old = rawindow;
+  if(n >= 0)
+    rawindow = min(n, MAXFILE);
+  return old;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -483,6 +562,7 @@ writei(struct inode *ip, char *src, uint off, uint n)
 {
   uint tot, m;
   struct buf *bp;
+  int r;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].write)
@@ -494,20 +574,27 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     return -1;
+  if(pcwrite(ip, src, off, n) < 0)
+    return -1;
 
+  r = n;
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
-    memmove(bp->data + off%BSIZE, src, m);
+    if(ucopy(bp->data + off%BSIZE, src, m) < 0){
+      brelse(bp);
+      r = -1;
+      break;
+    }
     log_write(bp);
     brelse(bp);
   }
 
-  if(n > 0 && off > ip->size){
+  if(tot > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
   }
-  return n;
+  return r;
 }
 
 //PAGEBREAK!
@@ -7,7 +7,7 @@
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
-//                                          free bit map | data blocks]
+//                              free bit map | data blocks | swap area ]
 //
 // mkfs computes the super block and builds an initial file system. The
 // super block describes the disk layout:
@@ -19,8 +19,18 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint swapstart;    // Block number of first swap block
+  uint nswap;        // Number of page-sized swap slots
 };
 
+// Most blocks a log transaction can hold, as many as the block
+// numbers one log header block has room for, and most blocks in
+// each of the two regions of the log.
+#define LOGMAX ((BSIZE - 2*sizeof(uint)) / sizeof(uint))
+#define LOGREGMAX 1024
+
+#define SWAPPGBLKS 8  // blocks per swap slot (PGSIZE/BSIZE)
+
 #define NDIRECT 12
 #define NINDIRECT (BSIZE / sizeof(uint))
 #define MAXFILE (NDIRECT + NINDIRECT)
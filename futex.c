@@ -0,0 +1,129 @@
+// Futexes: sleeping on a word of user memory.
+//
+// futexwait(uaddr, val) sleeps until a futexwake() on the same
+// word, but only if the word still holds val, so a wakeup
+// between the caller's test and the sleep is not lost.
+// futexwake(uaddr, n) wakes up to n of the sleepers.
+//
+// A word is named by its physical address, so threads, forked
+// processes sharing a MAP_SHARED page, and unrelated processes
+// attached to the same shm segment all agree on it. The caller
+// has faulted the word in writable (argptrw), so a private
+// page has already been copied and its address will not move.
+//
+// Sleepers queue in a small hash table, one spin lock per
+// bucket. Each waits on its own struct futexq, on its kernel
+// stack, as the sleep channel, so futexwake() can wake just n
+// of them rather than everyone hashed to the bucket.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct futexq {
+  uint pa;               // physical address of the word
+  int woken;
+  struct futexq *next;
+};
+
+struct {
+  struct spinlock lock;
+  struct futexq *head;
+} futexhash[NFUTEXHASH];
+
+void
+futexinit(void)
+{
+  int i;
+
+  for(i = 0; i < NFUTEXHASH; i++)
+    initlock(&futexhash[i].lock, "futex");
+}
+
+// Return the physical address of the int at user address
+// uaddr in the current process, or 0 if it is not mapped.
+static uint
+futexpa(int *uaddr)
+{
+  char *ka;
+
+  if((uint)uaddr % sizeof(int) != 0)
+    return 0;
+  ka = uva2ka(myproc()->pgdir, (char*)PGROUNDDOWN((uint)uaddr));
+  if(ka == 0)
+    return 0;
+  return V2P(ka) + (uint)uaddr % PGSIZE;
+}
+
+static uint
+futexhashpa(uint pa)
+{
+  return (pa >> 2) % NFUTEXHASH;
+}
+
+// Sleep until futexwake(uaddr) if *uaddr == val. Returns -1 if
+// *uaddr != val or on a bad address. Callers must recheck
+// their condition: the process may have been killed, and a
+// wakeup may have been meant for an earlier value.
+int
+futexwait(int *uaddr, int val)
+{
+  struct futexq q, **pp;
+  uint pa, h;
+
+  if((pa = futexpa(uaddr)) == 0)
+    return -1;
+  h = futexhashpa(pa);
+  acquire(&futexhash[h].lock);
+  if(*(int*)P2V(pa) != val){
+    release(&futexhash[h].lock);
+    return -1;
+  }
+  q.pa = pa;
+  q.woken = 0;
+  q.next = 0;
+  for(pp = &futexhash[h].head; *pp != 0; pp = &(*pp)->next)
+    ;
+  *pp = &q;  // first come, first woken
+  while(!q.woken && !myproc()->killed)
+    sleep(&q, &futexhash[h].lock);
+  if(!q.woken){
+    for(pp = &futexhash[h].head; *pp != &q; pp = &(*pp)->next)
+      ;
+    *pp = q.next;
+  }
+  release(&futexhash[h].lock);
+  return 0;
+}
+
+// Wake up to n processes sleeping in futexwait() on uaddr.
+// Returns the number woken, or -1 on a bad address.
+int
+futexwake(int *uaddr, int n)
+{
+  struct futexq *q, **pp;
+  uint pa, h;
+  int woken;
+
+  if((pa = futexpa(uaddr)) == 0)
+    return -1;
+  h = futexhashpa(pa);
+  woken = 0;
+  acquire(&futexhash[h].lock);
+  for(pp = &futexhash[h].head; (q = *pp) != 0 && woken < n; ){
+    if(q->pa != pa){
+      pp = &q->next;
+      continue;
+    }
+    *pp = q->next;
+    q->woken = 1;
+    wakeup(q);
+    woken++;
+  }
+  release(&futexhash[h].lock);
+  return woken;
+}
@@ -3,16 +3,46 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "fcntl.h"
 
 char buf[1024];
 int match(char*, char*);
 
+// Grep a file by mapping it, so lines are matched where they
+// lie instead of being copied into buf. The matcher stops at
+// a newline as well as at a nul. Returns -1 if fd can't be
+// mapped (a pipe or the console, say).
+int
+grepmap(char *pattern, int fd)
+{
+  struct stat st;
+  char *a, *p, *q, *end;
+
+  if(fstat(fd, &st) < 0 || st.type != T_FILE || st.size == 0)
+    return -1;
+  if((a = mmap(0, st.size, PROT_READ, MAP_PRIVATE, fd, 0)) == (char*)-1)
+    return -1;
+  end = a + st.size;
+  for(p = a; p < end; p = q+1){
+    for(q = p; q < end && *q != '\n'; q++)
+      ;
+    if(q == end)
+      break;  // like grep(), ignore an unterminated last line
+    if(match(pattern, p))
+      write(1, p, q+1 - p);
+  }
+  munmap(a, st.size);
+  return 0;
+}
+
 void
 grep(char *pattern, int fd)
 {
   int n, m;
   char *p, *q;
 
+  if(grepmap(pattern, fd) == 0)
+    return;
   m = 0;
   while((n = read(fd, buf+m, sizeof(buf)-m-1)) > 0){
     m += n;
@@ -65,6 +95,9 @@ main(int argc, char *argv[])
 
 // Regexp matcher from Kernighan & Pike,
 // The Practice of Programming, Chapter 9.
+// Text ends at a nul or a newline.
+
+#define END(c) ((c) == '\0' || (c) == '\n')
 
 int matchhere(char*, char*);
 int matchstar(int, char*, char*);
@@ -77,7 +110,7 @@ match(char *re, char *text)
   do{  // must look at empty string
     if(matchhere(re, text))
       return 1;
-  }while(*text++ != '\0');
+  }while(!END(*text++));
   return 0;
 }
 
@@ -89,8 +122,8 @@ int matchhere(char *re, char *text)
   if(re[1] == '*')
     return matchstar(re[0], re+2, text);
   if(re[0] == '$' && re[1] == '\0')
-    return *text == '\0';
-  if(*text!='\0' && (re[0]=='.' || re[0]==*text))
+    return END(*text);
+  if(!END(*text) && (re[0]=='.' || re[0]==*text))
     return matchhere(re+1, text+1);
   return 0;
 }
@@ -101,7 +134,7 @@ int matchstar(int c, char *re, char *text)
   do{  // a * matches zero or more instances
     if(matchhere(re, text))
       return 1;
-  }while(*text!='\0' && (*text++==c || c=='.'));
+  }while(!END(*text) && (*text++==c || c=='.'));
   return 0;
 }
 
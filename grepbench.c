@@ -0,0 +1,80 @@
+// Buffer cache hit rate for a repeated grep.
+//
+//   grepbench [files] [runs]
+//
+// Writes files (default 8) files of FILEKB Kbytes of text and
+// runs grep over all of them runs times (default 5), looking for
+// a word that is not there. Prints the buffer cache size and the
+// hit rate of each run; once the cache has grown to hold the
+// files, every block a run reads should already be cached.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "meminfo.h"
+
+#define FILEKB 32
+#define MAXFILES 10
+
+char line[] = "the quick brown fox jumps over the lazy dog 0123456789\n";
+char names[MAXFILES][16];
+char *args[MAXFILES+3];
+
+void
+mkfiles(int nfiles)
+{
+  int i, fd, n;
+
+  for(i = 0; i < nfiles; i++){
+    strcpy(names[i], "grepbench.0");
+    names[i][10] = '0' + i;
+    if((fd = open(names[i], O_CREATE|O_RDWR)) < 0){
+      printf(2, "grepbench: cannot create %s\n", names[i]);
+      exit();
+    }
+    for(n = 0; n < FILEKB*1024; n += sizeof(line) - 1)
+      write(fd, line, sizeof(line) - 1);
+    close(fd);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct meminfo m0, m1;
+  int i, nfiles, runs, hits, misses, t0;
+
+  nfiles = argc >= 2 ? atoi(argv[1]) : 8;
+  runs = argc >= 3 ? atoi(argv[2]) : 5;
+  if(nfiles < 1 || nfiles > MAXFILES){
+    printf(2, "grepbench: 1 to %d files\n", MAXFILES);
+    exit();
+  }
+  mkfiles(nfiles);
+  args[0] = "grep";
+  args[1] = "xyzzy";
+  for(i = 0; i < nfiles; i++)
+    args[2+i] = names[i];
+  args[2+nfiles] = 0;
+
+  for(i = 0; i < runs; i++){
+    meminfo(&m0);
+    t0 = uptime();
+    if(fork() == 0){
+      exec("grep", args);
+      printf(2, "grepbench: exec grep failed\n");
+      exit();
+    }
+    wait();
+    meminfo(&m1);
+    hits = m1.bufhits - m0.bufhits;
+    misses = m1.bufmisses - m0.bufmisses;
+    printf(1, "run %d: %d ticks, %d buffers, %d hits %d misses, "
+           "%d%% hit rate\n", i, uptime() - t0, m1.bufs, hits, misses,
+           hits + misses ? hits * 100 / (hits + misses) : 0);
+  }
+  for(i = 0; i < nfiles; i++)
+    unlink(names[i]);
+  exit();
+}
@@ -1,4 +1,16 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code, and the block device interface the
+// buffer cache uses, behind which disk 1 may instead be a
+// virtio-blk device (virtio.c).
+//
+// Requests are sorted by block number and served in sweeps of
+// increasing block number (C-LOOK), and requests for consecutive
+// blocks go to the disk as one multi-sector command.
+//
+// If there is a PCI IDE controller that can master the bus, the
+// controller moves the data by DMA, following a table of the
+// physical addresses of the bufs' data that idestart() fills in.
+// Otherwise, or once a DMA transfer has failed, the CPU moves it
+// with programmed I/O (insl/outsl).
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +24,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,16 +36,64 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
+// Bus-master DMA registers of the primary channel, from idebm.
+#define BM_CMD        0     // command
+#define BM_STATUS     2     // status; write 1s to clear ERR, INTR
+#define BM_PRDT       4     // physical address of PRD table
+#define BM_CMD_START  0x01  // start transfer
+#define BM_CMD_READ   0x08  // transfer is into memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+// A physical region descriptor: one piece of a DMA transfer,
+// which must not cross a 64-Kbyte boundary. Each buf's data
+// needs at most two.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last descriptor of the table
+
+// idebusy points to the bufs now being read/written to the disk,
+// consecutive blocks moved by one command, chained by qnext.
+// idequeue holds the bufs waiting for the disk, in C-LOOK order:
+// those at or past idepos, the block after the last one moved,
+// by ascending block number, then those before it, likewise, for
+// the next sweep. idestart() takes the run of consecutive blocks
+// at the head of the queue, up to idemerge of them.
 // You must hold idelock while manipulating queue.
 
-static struct spinlock idelock;
+struct spinlock idelock;
+static struct buf *idebusy;
 static struct buf *idequeue;
+static uint idepos;
+static int idemerge = 1;   // blocks per PIO command
+
+// DMA: idebm is the bus-master port, or 0 to use PIO. Lying in
+// one page, the PRD table cannot cross 64 Kbytes.
+#if IDEMERGE < 1 || (IDEMERGE & (IDEMERGE-1)) != 0
+#error "IDEMERGE must be a power of 2, as READ/WRITE MULTIPLE needs"
+#endif
+#if 2*IDEMERGE*8 > PGSIZE
+#error "IDEMERGE too large: the PRD table must fit in a page"
+#endif
+static uint idebm;
+static struct prd prdt[2*IDEMERGE] __attribute__((aligned(PGSIZE)));
+
+// Statistics, for meminfo().
+static uint idereads, idewrites, idecmds, ideseek;
+static uint64 idecycles;   // CPU time spent in the driver
 
 static int havedisk1;
-static void idestart(struct buf*);
+static int idevirtio;   // disk 1 is a virtio-blk device
+static void idestart(void);
+static int idesetmult(int);
+static void idedmainit(void);
 
 // Wait for IDE disk to become ready.
 static int
@@ -65,35 +126,135 @@ ideinit(void)
     }
   }
 
+  // Let READ/WRITE MULTIPLE move IDEMERGE blocks per interrupt.
+  idemerge = IDEMERGE;
+  if(idesetmult(0) < 0 || (havedisk1 && idesetmult(1) < 0))
+    idemerge = 1;
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
+
+  if(IDEDMA)
+    idedmainit();
+
+  if(virtioinit() == 0)
+    idevirtio = 1;
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Find the PCI IDE controller and let it master the bus; its
+// fifth base address register holds the bus-master ports.
 static void
-idestart(struct buf *b)
+idedmainit(void)
 {
-  if(b == 0)
+  struct pcidev d;
+
+  if(pcifind(PCI_ANY, PCI_ANY, 0x01, 0x01, &d) < 0 || d.bar[4] == 0)
+    return;
+  pciwrite(&d, PCI_CMD, pciread(&d, PCI_CMD) | PCI_CMD_IO | PCI_CMD_MASTER);
+  idebm = d.bar[4];
+  outb(idebm + BM_CMD, 0);
+  outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+  cprintf("ide: bus-master DMA at port 0x%x\n", idebm);
+}
+
+// Describe n bytes at physical address pa in prdt, from entry i
+// on. Returns the entry after the last one used.
+static int
+prdfill(int i, uint pa, uint n)
+{
+  uint m;
+
+  for(; n > 0; n -= m, pa += m, i++){
+    m = 0x10000 - (pa & 0xffff);
+    if(m > n)
+      m = n;
+    prdt[i].addr = pa;
+    prdt[i].len = m;
+    prdt[i].flags = 0;
+  }
+  return i;
+}
+
+// Set the number of sectors a READ/WRITE MULTIPLE command moves
+// between interrupts on disk dev to IDEMERGE blocks' worth, with
+// the interrupt masked. Returns -1 if the disk refuses.
+static int
+idesetmult(int dev)
+{
+  int r;
+
+  outb(0x3f6, 2);  // no interrupt
+  outb(0x1f6, 0xe0 | (dev<<4));
+  outb(0x1f2, IDEMERGE*BSIZE/SECTOR_SIZE);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  r = idewait(1);
+  outb(0x3f6, 0);
+  return r;
+}
+
+// Start the request at the head of idequeue, together with
+// those after it for the next blocks of the same disk in the
+// same direction.  Caller must hold idelock.
+static void
+idestart(void)
+{
+  struct buf *b, *last, *p;
+  int n, max, i;
+
+  if((b = idequeue) == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  max = idebm ? IDEMERGE : idemerge;
+  n = 1;
+  for(last = b; n < max && (p = last->qnext) != 0; last = p, n++)
+    if(p->dev != b->dev || p->blockno != last->blockno + 1 ||
+       (p->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+  idequeue = last->qnext;
+  last->qnext = 0;
+  idebusy = b;
+
+  if(last->blockno >= FSSIZE + NSWAP*SWAPPGBLKS)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int nsector = n * sector_per_block;
+  int read_cmd = (nsector == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
 
+  idecmds++;
+  ideseek += b->blockno > idepos ? b->blockno - idepos : idepos - b->blockno;
+  idepos = last->blockno + 1;
+  if(b->flags & B_DIRTY)
+    idewrites += n;
+  else
+    idereads += n;
+
+  if(idebm){
+    i = 0;
+    for(p = b; p; p = p->qnext)
+      i = prdfill(i, V2P(p->data), BSIZE);
+    prdt[i-1].flags = PRD_EOT;
+    outl(idebm + BM_PRDT, V2P(prdt));
+    outb(idebm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsector);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idebm){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(p = b; p; p = p->qnext)
+      outsl(0x1f0, p->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,66 +264,216 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next, *done[IDEMERGE];
+  int n, st;
+  uint64 t0;
 
-  // First queued buffer is the active request.
+  t0 = rdtsc();
+
+  // idebusy is the active request.
   acquire(&idelock);
 
-  if((b = idequeue) == 0){
+  if((b = idebusy) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+
+  if(idebm){
+    // Stop the controller. If the transfer failed, give up on
+    // DMA and do it again with PIO.
+    if(!((st = inb(idebm + BM_STATUS)) & BM_ST_INTR)){
+      release(&idelock);  // not done yet
+      return;
+    }
+    outb(idebm + BM_CMD, 0);
+    outb(idebm + BM_STATUS, BM_ST_ERR|BM_ST_INTR);
+    if(idewait(1) < 0 || (st & BM_ST_ERR)){
+      cprintf("ide: DMA failed, using PIO\n");
+      idebm = 0;
+      for(next = b; next->qnext; next = next->qnext)
+        ;
+      next->qnext = idequeue;
+      idequeue = b;
+      idestart();
+      release(&idelock);
+      return;
+    }
+  }
+  idebusy = 0;
 
   // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(!idebm && !(b->flags & B_DIRTY) && idewait(1) >= 0)
+    for(next = b; next; next = next->qnext)
+      insl(0x1f0, next->data, BSIZE/4);
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  for(n = 0; b; b = b->qnext)
+    done[n++] = b;
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
-    idestart(idequeue);
+    idestart();
 
+  idecycles += rdtsc() - t0;
+  idedone(done, n);
+}
+
+// Finish the transfers of the n bufs in bs: mark them done and
+// wake whoever waits for them, or for any buf, then release
+// idelock and call the iodone functions of those that have one.
+// Caller must hold idelock. Once it is released, the bufs are
+// their owners' again, so those with iodone are sorted to the
+// front of bs first.
+void
+idedone(struct buf **bs, int n)
+{
+  struct buf *b;
+  void (*iodone)(struct buf*);
+  int i, m;
+
+  m = 0;
+  for(i = 0; i < n; i++){
+    b = bs[i];
+    b->flags |= B_VALID;
+    b->flags &= ~(B_DIRTY|B_IO);
+    if(b->iodone){
+      bs[i] = bs[m];
+      bs[m++] = b;
+    } else
+      wakeup(b);
+  }
+  wakeup(&idequeue);
   release(&idelock);
+
+  for(i = 0; i < m; i++){
+    iodone = bs[i]->iodone;
+    bs[i]->iodone = 0;
+    iodone(bs[i]);
+  }
+}
+
+// Report the blocks read and written, the commands that moved
+// them, the distance in blocks the disk head travelled, and the
+// CPU time spent starting and finishing commands, in units of
+// 1024 cycles.
+void
+idestat(uint *reads, uint *writes, uint *cmds, uint *seek, uint *kcycles)
+{
+  uint64 cycles;
+
+  acquire(&idelock);
+  *reads = idereads;
+  *writes = idewrites;
+  *cmds = idecmds;
+  *seek = ideseek;
+  cycles = idecycles;
+  if(idevirtio)
+    virtiostat(reads, writes, cmds, &cycles);
+  *kcycles = cycles >> 10;
+  release(&idelock);
+}
+
+// Does a belong before b in idequeue?
+static int
+idebefore(struct buf *a, struct buf *b)
+{
+  if((a->blockno < idepos) != (b->blockno < idepos))
+    return a->blockno >= idepos;
+  return a->blockno <= b->blockno;
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
-// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
-// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// Start syncing buf with disk and return without waiting.
+// If B_DIRTY is set, write buf to disk, else read it; either way
+// B_IO stays set until the transfer is over, when B_DIRTY is
+// cleared and B_VALID set as by iderw. If b->iodone is set, the
+// interrupt handler calls it then, without idelock held, and
+// clears it. The caller must not touch b until the transfer is
+// over, except by waiting for it.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
   struct buf **pp;
+  uint64 t0;
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
     panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
+  if(b->dev != 0 && !havedisk1 && !idevirtio)
     panic("iderw: ide disk 1 not present");
 
   acquire(&idelock);  //DOC:acquire-lock
+  if(b->flags & B_IO)
+    panic("iderw: buf busy");
+  b->flags |= B_IO;
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+  if(b->dev != 0 && idevirtio){
+    virtiostart(b);
+    release(&idelock);
+    return;
+  }
+
+  // Insert b in idequeue, in C-LOOK order.
+  for(pp=&idequeue; *pp && idebefore(*pp, b); pp=&(*pp)->qnext)  //DOC:insert-queue
     ;
+  b->qnext = *pp;
   *pp = b;
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idebusy == 0){
+    t0 = rdtsc();
+    idestart();
+    idecycles += rdtsc() - t0;
+  }
+
+  release(&idelock);
+}
 
-  // Wait for request to finish.
-  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+// Wait for the transfer idesubmit started on b to finish.
+void
+ideiowait(struct buf *b)
+{
+  acquire(&idelock);
+  while(b->flags & B_IO)
     sleep(b, &idelock);
-  }
+  release(&idelock);
+}
 
+// Wait until one of the n bufs in bs has no transfer in
+// flight and return it. Null entries are skipped, so a caller
+// can clear the ones it has dealt with and call again; if all
+// are null, returns 0.
+struct buf*
+ideiowaitany(struct buf **bs, int n)
+{
+  int i, busy;
 
+  acquire(&idelock);
+  for(;;){
+    busy = 0;
+    for(i = 0; i < n; i++){
+      if(bs[i] == 0)
+        continue;
+      if(!(bs[i]->flags & B_IO)){
+        release(&idelock);
+        return bs[i];
+      }
+      busy = 1;
+    }
+    if(!busy)
+      break;
+    sleep(&idequeue, &idelock);
+  }
   release(&idelock);
+  return 0;
+}
+
+// Sync buf with disk.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  ideiowait(b);
 }
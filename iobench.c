@@ -0,0 +1,109 @@
+// read() and write() bandwidth through pipes and files.
+//
+//   iobench [kb]
+//
+// For each buffer size, a child writes kb Kbytes (default 1024)
+// into a pipe for the parent to read, and then a 64-Kbyte file
+// is written once and read back until kb Kbytes have been read.
+// The file fits in the buffer cache, so the reads measure the
+// cost of the system calls and of copying the data out.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+
+#define FILESIZE (64*1024)
+#define MAXBUF 8192
+
+char buf[MAXBUF];
+int sizes[] = { 16, 512, 4096, 8192 };
+
+// Report n bytes moved in t ticks, in Kbytes per second.
+void
+report(char *what, int bufsize, int n, int t)
+{
+  printf(1, "%s: %d-byte buffers: %d Kbytes in %d ticks", what,
+         bufsize, n / 1024, t);
+  if(t > 0)
+    printf(1, ", %d Kbytes/s", n / 1024 * 100 / t);
+  printf(1, "\n");
+}
+
+void
+pipebench(int bufsize, int total)
+{
+  int fds[2], n, got, t0;
+
+  if(pipe(fds) < 0){
+    printf(2, "iobench: pipe failed\n");
+    exit();
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    close(fds[0]);
+    for(n = 0; n < total; n += bufsize)
+      if(write(fds[1], buf, bufsize) != bufsize){
+        printf(2, "iobench: pipe write failed\n");
+        break;
+      }
+    exit();
+  }
+  close(fds[1]);
+  got = 0;
+  while((n = read(fds[0], buf, bufsize)) > 0)
+    got += n;
+  close(fds[0]);
+  wait();
+  if(got != total)
+    printf(2, "iobench: read %d of %d pipe bytes\n", got, total);
+  report("pipe", bufsize, got, uptime() - t0);
+}
+
+void
+filebench(int bufsize, int total)
+{
+  int fd, n, got, t0, t1;
+
+  fd = open("iobench.tmp", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(2, "iobench: cannot create iobench.tmp\n");
+    exit();
+  }
+  t0 = uptime();
+  for(n = 0; n < FILESIZE; n += bufsize)
+    if(write(fd, buf, bufsize) != bufsize){
+      printf(2, "iobench: file write failed\n");
+      break;
+    }
+  close(fd);
+  t1 = uptime();
+  report("file write", bufsize, n, t1 - t0);
+
+  got = 0;
+  while(got < total){
+    if((fd = open("iobench.tmp", O_RDONLY)) < 0){
+      printf(2, "iobench: cannot open iobench.tmp\n");
+      exit();
+    }
+    while(got < total && (n = read(fd, buf, bufsize)) > 0)
+      got += n;
+    close(fd);
+  }
+  report("file read", bufsize, got, uptime() - t1);
+  unlink("iobench.tmp");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, total;
+
+  total = (argc >= 2 ? atoi(argv[1]) : 1024) * 1024;
+  memset(buf, 'x', sizeof(buf));
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+    pipebench(sizes[i], total);
+  for(i = 0; i < sizeof(sizes)/sizeof(sizes[0]); i++)
+    filebench(sizes[i], total);
+  exit();
+}
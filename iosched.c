@@ -0,0 +1,136 @@
+// Disk request scheduling and merging.
+//
+//   iosched [nproc]
+//
+// Times three workloads and shows the disk traffic of each: the
+// blocks moved, the commands that moved them, and how far the
+// disk head travelled between commands.
+//   write   one process writes a file as large as the file system
+//           allows, in 8-Kbyte writes, each a few log commits
+//   commit  nproc processes (default 4) each make NSMALL one-block
+//           writes to a file of its own, a commit apiece
+//   read    nproc processes each read a file of its own, starting
+//           from an empty buffer cache, so that their requests
+//           are at the disk together
+// Build the kernel with make IDEMERGE=1 to see the disk without
+// merging. Needs a kernel built with make DROPCACHE=1.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "meminfo.h"
+
+#define NSMALL 100
+#define MAXPROC 8
+
+char buf[8192];
+struct meminfo m0;
+int t0;
+
+void
+name(char *s, int i)
+{
+  strcpy(s, "iosched.0");
+  s[8] = '0' + i;
+}
+
+void
+start(void)
+{
+  meminfo(&m0);
+  t0 = uptime();
+}
+
+void
+report(char *what)
+{
+  struct meminfo m1;
+  int t, blocks, cmds;
+
+  t = uptime() - t0;
+  meminfo(&m1);
+  blocks = m1.diskreads - m0.diskreads + m1.diskwrites - m0.diskwrites;
+  cmds = m1.diskcmds - m0.diskcmds;
+  printf(1, "%s: %d ticks, %d blocks in %d commands, "
+         "%d blocks/command x10, seek %d blocks\n", what, t, blocks, cmds,
+         cmds ? blocks*10/cmds : 0, m1.diskseek - m0.diskseek);
+}
+
+void
+writefile(char *path, int n, int size)
+{
+  int fd;
+
+  if((fd = open(path, O_CREATE|O_RDWR)) < 0){
+    printf(2, "iosched: cannot create %s\n", path);
+    exit();
+  }
+  while(n-- > 0)
+    if(write(fd, buf, size) != size){
+      printf(2, "iosched: write failed\n");
+      exit();
+    }
+  close(fd);
+}
+
+int
+main(int argc, char *argv[])
+{
+  char path[16];
+  int i, fd, nproc;
+
+  nproc = argc >= 2 ? atoi(argv[1]) : 4;
+  if(nproc < 1 || nproc > MAXPROC){
+    printf(2, "iosched: 1 to %d processes\n", MAXPROC);
+    exit();
+  }
+  memset(buf, 'i', sizeof(buf));
+
+  name(path, 0);
+  start();
+  writefile(path, MAXFILE*BSIZE/sizeof(buf), sizeof(buf));
+  report("write");
+  unlink(path);
+
+  start();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      name(path, i);
+      writefile(path, NSMALL, BSIZE);
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  report("commit");
+
+  if(dropcache() < 0){
+    printf(2, "iosched: dropcache failed; build with DROPCACHE=1\n");
+    exit();
+  }
+  start();
+  for(i = 0; i < nproc; i++){
+    if(fork() == 0){
+      name(path, i);
+      if((fd = open(path, O_RDONLY)) < 0){
+        printf(2, "iosched: cannot open %s\n", path);
+        exit();
+      }
+      while(read(fd, buf, BSIZE) > 0)
+        ;
+      close(fd);
+      exit();
+    }
+  }
+  for(i = 0; i < nproc; i++)
+    wait();
+  report("read");
+
+  for(i = 0; i < nproc; i++){
+    name(path, i);
+    unlink(path);
+  }
+  exit();
+}
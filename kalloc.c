@@ -1,6 +1,25 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
 // and pipe buffers. Allocates 4096-byte pages.
+//
+// Each page carries a reference count so that read-only user
+// pages can be shared between address spaces (see pagefault()
+// and copyuvm() in vm.c). kalloc() returns a page with one
+// reference; kfree() drops one and frees the page with the last.
+//
+// When the free list is empty (or kmemlimit() pages are in use),
+// kalloc() takes a page back from the buffer cache (bshrink() in
+// bio.c) or swaps a user page out to disk to make room, provided
+// its caller may sleep; see swap.c.
+//
+// Free memory is kept by a buddy allocator: a free block of
+// order k is 2^k pages, aligned on its size in physical memory,
+// and a freed block merges with its buddy (the other half of the
+// block of order k+1) whenever that is free too. kalloc() and
+// kfree() work on single pages, the common case, taking them
+// from the order-0 list first; kallocpages() hands out larger
+// blocks, such as the 4-Mbyte superpages of superpage heaps
+// (see superpages() in proc.c).
 
 #include "types.h"
 #include "defs.h"
@@ -8,6 +27,8 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "x86.h"
+#include "proc.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -15,12 +36,19 @@ extern char end[]; // first address after kernel loaded from ELF file
 
 struct run {
   struct run *next;
+  struct run *prev;
 };
 
 struct {
   struct spinlock lock;
   int use_lock;
-  struct run *freelist;
+  struct run free[NORDER];         // circular lists of free blocks
+  uint nblocks[NORDER];            // blocks on each list
+  uint nfree;                      // free pages, in all
+  uint npages;                     // pages ever handed to kfree by kinit
+  uint limit;                      // if non-zero, most pages in use at once
+  ushort ref[PHYSTOP/PGSIZE];      // references to each physical page
+  uchar order[PHYSTOP/PGSIZE];     // 1+order if first page of a free block
 } kmem;
 
 // Initialization happens in two phases.
@@ -31,8 +59,12 @@ struct {
 void
 kinit1(void *vstart, void *vend)
 {
+  int i;
+
   initlock(&kmem.lock, "kmem");
   kmem.use_lock = 0;
+  for(i = 0; i < NORDER; i++)
+    kmem.free[i].next = kmem.free[i].prev = &kmem.free[i];
   freerange(vstart, vend);
 }
 
@@ -43,13 +75,90 @@ kinit2(void *vstart, void *vend)
   kmem.use_lock = 1;
 }
 
+// Put the block of 2^order pages at v on its free list.
+// Caller must hold kmem.lock.
+static void
+addfree(char *v, int order)
+{
+  struct run *r, *head;
+
+  r = (struct run*)v;
+  head = &kmem.free[order];
+  r->next = head->next;
+  r->prev = head;
+  head->next->prev = r;
+  head->next = r;
+  kmem.order[V2P(v)/PGSIZE] = 1 + order;
+  kmem.nblocks[order]++;
+}
+
+static void
+delfree(char *v, int order)
+{
+  struct run *r;
+
+  r = (struct run*)v;
+  r->prev->next = r->next;
+  r->next->prev = r->prev;
+  kmem.order[V2P(v)/PGSIZE] = 0;
+  kmem.nblocks[order]--;
+}
+
+// Take a block of 2^order pages, splitting a larger one if
+// need be. Returns 0 if there is none. Caller must hold
+// kmem.lock.
+static char*
+buddyalloc(int order)
+{
+  struct run *r;
+  int k;
+
+  for(k = order; k < NORDER; k++)
+    if(kmem.free[k].next != &kmem.free[k])
+      break;
+  if(k == NORDER)
+    return 0;
+  r = kmem.free[k].next;
+  delfree((char*)r, k);
+  // Return the upper halves, keeping the lower.
+  while(k > order){
+    k--;
+    addfree((char*)r + (PGSIZE << k), k);
+  }
+  kmem.nfree -= 1 << order;
+  return (char*)r;
+}
+
+// Free the block of 2^order pages at v, merging it with its
+// buddy for as long as the buddy is free too. Caller must hold
+// kmem.lock.
+static void
+buddyfree(char *v, int order)
+{
+  uint pa, buddy;
+
+  kmem.nfree += 1 << order;
+  pa = V2P(v);
+  for(; order < NORDER-1; order++){
+    buddy = pa ^ (PGSIZE << order);
+    if(buddy >= PHYSTOP || kmem.order[buddy/PGSIZE] != 1 + order)
+      break;
+    delfree(P2V(buddy), order);
+    if(buddy < pa)
+      pa = buddy;
+  }
+  addfree(P2V(pa), order);
+}
+
 void
 freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.npages++;
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
 // Free the page of physical memory pointed at by v,
@@ -59,19 +168,28 @@ freerange(void *vstart, void *vend)
 void
 kfree(char *v)
 {
-  struct run *r;
-
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] > 1){
+    // Still mapped somewhere else.
+    kmem.ref[V2P(v)/PGSIZE]--;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  kmem.ref[V2P(v)/PGSIZE] = 0;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
-  r = (struct run*)v;
-  r->next = kmem.freelist;
-  kmem.freelist = r;
+  buddyfree(v, 0);
   if(kmem.use_lock)
     release(&kmem.lock);
 }
@@ -82,15 +200,135 @@ kfree(char *v)
 char*
 kalloc(void)
 {
-  struct run *r;
+  char *r;
+  int i;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
+  for(i = 0; ; i++){
+    if(kmem.use_lock)
+      acquire(&kmem.lock);
+    r = 0;
+    if(kmem.limit == 0 || kmem.npages - kmem.nfree < kmem.limit)
+      r = buddyalloc(0);
+    if(r)
+      kmem.ref[V2P(r)/PGSIZE] = 1;
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    // Out of memory: shrink the buffer cache or swap a page
+    // out, if the caller holds no spin locks (so interrupts are
+    // on) and can sleep. Give up if others keep taking the
+    // pages freed.
+    if(r || !kmem.use_lock || !(readeflags() & FL_IF) ||
+       myproc() == 0 || i >= 8 || (bshrink() < 0 && swapout() < 0))
+      return r;
+  }
+}
+
+// Add a reference to the page at v, which must have been
+// returned by kalloc(). The page is freed only after a
+// matching number of extra kfree() calls.
+void
+kincref(char *v)
+{
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kincref");
+
+  acquire(&kmem.lock);
+  if(kmem.ref[V2P(v)/PGSIZE] < 1)
+    panic("kincref: free page");
+  kmem.ref[V2P(v)/PGSIZE]++;
+  release(&kmem.lock);
+}
+
+// Return the number of references to the page at v.
+int
+krefcount(char *v)
+{
+  int n;
+
+  acquire(&kmem.lock);
+  n = kmem.ref[V2P(v)/PGSIZE];
+  release(&kmem.lock);
+  return n;
+}
+
+// Allow at most n pages to be in use at once, or any number
+// if n is 0, so that swapping can be tried without filling
+// all of memory.
+void
+kmemlimit(uint n)
+{
+  acquire(&kmem.lock);
+  kmem.limit = n;
+  release(&kmem.lock);
+}
+
+// Report the number of free and total pages.
+void
+kmemstat(uint *nfree, uint *npages)
+{
+  acquire(&kmem.lock);
+  *nfree = kmem.nfree;
+  *npages = kmem.npages;
+  release(&kmem.lock);
+}
+
+
+// Report the number of free blocks of each order.
+void
+kbuddystat(uint *nblocks)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  for(i = 0; i < NORDER; i++)
+    nblocks[i] = kmem.nblocks[i];
+  release(&kmem.lock);
+}
+
+// Allocate 2^order physically contiguous pages, aligned on
+// their size. Returns 0 if there is no such block free;
+// swapping pages out would not make one.
+char*
+kallocpages(int order)
+{
+  char *r;
+
+  if(order < 0 || order >= NORDER)
+    panic("kallocpages");
+  acquire(&kmem.lock);
+  r = 0;
+  if(kmem.limit == 0 || kmem.npages - kmem.nfree + (1 << order) <= kmem.limit)
+    r = buddyalloc(order);
   if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  return (char*)r;
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+  release(&kmem.lock);
+  return r;
 }
 
+// Free a block returned by kallocpages(order).
+void
+kfreepages(char *v, int order)
+{
+  if((uint)v % (PGSIZE << order) || v < end || V2P(v) >= PHYSTOP)
+    panic("kfreepages");
+
+  acquire(&kmem.lock);
+  kmem.ref[V2P(v)/PGSIZE] = 0;
+  buddyfree(v, order);
+  release(&kmem.lock);
+}
+
+// Allocate one 4-Mbyte superpage, physically contiguous
+// and aligned. Returns 0 if none is free.
+char*
+ksuperalloc(void)
+{
+  return kallocpages(SUPERPGORDER);
+}
+
+// Free a superpage returned by ksuperalloc().
+void
+ksuperfree(char *v)
+{
+  kfreepages(v, SUPERPGORDER);
+}
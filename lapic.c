@@ -113,6 +113,17 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send an interrupt with the given vector to the CPU with the
+// given APIC id. Caller must have interrupts off.
+void
+lapicipi(uchar apicid, int vector)
+{
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
@@ -1,6 +1,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -18,107 +20,229 @@
 // its start and end. Usually begin_op() just increments
 // the count of in-progress FS system calls and returns.
 // But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// sleeps until the log writer has taken the transaction.
+// end_op() of a system call that changed something sleeps
+// until its transaction has committed.
+//
+// Commits are made by the log writer, a kernel process, which
+// takes the open transaction when no system call is in it, or
+// when one is waiting for log space, or when the transaction
+// has been open LOGDELAY ticks. Taking it needs only copies in
+// memory, after which system calls go on into a new transaction
+// while the writer puts the old one on disk, so that the system
+// calls that arrive during a commit all share the next one.
 //
 // The log is a physical re-do log containing disk blocks.
-// The on-disk log format:
+// The on-disk log is two regions, used in turn. A region holds
+// a chain of transactions one after another, each in the format:
 //   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// Each header has the sequence number after the one before it.
+// The blocks of a transaction go to the log as one batch of
+// asynchronous writes, and the header when they are on disk.
+//
+// Committed blocks are not written home at once, but stay
+// pinned in the cache, so that a block that many transactions
+// change, such as a bitmap or directory block, goes home once.
+// When the region cannot take another transaction, the writer
+// checkpoints: it writes home every block committed since the
+// last checkpoint, and starts over at the other region. With
+// LOGDEFER 0 it checkpoints after every commit.
+//
+// A checkpoint skips blocks that the open transaction has
+// changed since: their home copy must not get changes not yet
+// committed. Then the next transaction holds the newer version
+// of such a block, and the region of the skipped one stays
+// committed until the next one commits. Recovery installs the
+// committed chains in the order of their sequence numbers.
+//
+// The writer must never wait for a cache buffer, since system
+// calls waiting for one may be waiting for it. It writes the log
+// from buffers of its own, outside the cache (bprivate() in
+// bio.c), and initlog() grows the cache by enough buffers for the
+// blocks of the open transaction and the one being committed.
+// The blocks waiting for a checkpoint are as many as the rest of
+// the cache holds: when bget() finds every buffer in use, it
+// calls logpressure(), and the writer checkpoints at once, even
+// while waiting for the system calls in a transaction to end.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
 struct logheader {
   int n;
-  int block[LOGSIZE];
+  uint seq;
+  int block[LOGMAX];
 };
 
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int region;      // blocks in each region
+  int size;        // blocks a transaction may log
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int freezing;    // log writer is taking the transaction, please wait.
+  int nwait;       // begin_op()s waiting for log space
+  uint seq;        // sequence number of the open transaction
+  uint done;       // sequence number of the last committed one
+  uint opened;     // ticks when the open transaction got its first block
   int dev;
-  struct logheader lh;
+  struct logheader lh;   // the open transaction
+  struct logheader clh;  // the one being committed
+  int cur;         // region being appended to
+  int tail;        // where in it the next transaction goes
+  int pending;     // earlier region still committed, or -1
+  int nckpt;       // blocks committed since the last checkpoint
+  int ckpt[LOGREGMAX];
+  int ckptwant;    // bget() is out of buffers; checkpoint now
+  int ready;       // recovery is done
+  struct buf *lbuf[LOGMAX];  // the writer's own, for log blocks
+  struct buf *hbuf;          // and for headers
+  uint commits;    // transactions committed
+  uint waits;      // begin_op()s that waited for log space
+  uint ckpts;      // checkpoints
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void logwriter(void*);
 
 void
 initlog(int dev)
 {
-  if (sizeof(struct logheader) >= BSIZE)
+  if (sizeof(struct logheader) > BSIZE)
     panic("initlog: too big logheader");
 
   struct superblock sb;
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.region = sb.nlog / 2;
+  log.size = log.region - 1;  // less its header block
+  if (log.size > LOGMAX)
+    log.size = LOGMAX;
   log.dev = dev;
-  recover_from_log();
+  if (log.size < MAXOPBLOCKS || log.region > LOGREGMAX)
+    panic("initlog: bad log size");
+  breserve(2*log.size);
+  log.pending = -1;
+  kproc("logwriter", logwriter, 0);
+
+  // The writer recovers, with its own buffers.
+  acquire(&log.lock);
+  while(!log.ready)
+    sleep(&log.ready, &log.lock);
+  release(&log.lock);
 }
 
-// Copy committed blocks from log to their home location
-static void
-install_trans(void)
+// Block pos of log region r.
+static int
+logblock(int r, int pos)
 {
-  int tail;
-
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
-  }
+  return log.start + r*log.region + pos;
 }
 
-// Read the log header from disk into the in-memory log header
+// Read the header at pos in log region r from disk into *lh.
 static void
-read_head(void)
+read_head(int r, int pos, struct logheader *lh)
 {
-  struct buf *buf = bread(log.dev, log.start);
-  struct logheader *lh = (struct logheader *) (buf->data);
+  struct buf *buf = bread(log.dev, logblock(r, pos));
+  struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  log.lh.n = lh->n;
-  for (i = 0; i < log.lh.n; i++) {
-    log.lh.block[i] = lh->block[i];
+  lh->n = hb->n;
+  lh->seq = hb->seq;
+  for (i = 0; i < lh->n && i < LOGMAX; i++) {
+    lh->block[i] = hb->block[i];
   }
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write *lh to the header at pos in log region r on disk.
 // This is the true point at which the
-// current transaction commits.
+// transaction commits.
 static void
-write_head(void)
+write_head(int r, int pos, struct logheader *lh)
 {
-  struct buf *buf = bread(log.dev, log.start);
+  struct buf *buf = log.hbuf;
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  buf->dev = log.dev;
+  buf->blockno = logblock(r, pos);
+  memset(buf->data, 0, BSIZE);
+  hb->n = lh->n;
+  hb->seq = lh->seq;
+  for (i = 0; i < lh->n; i++) {
+    hb->block[i] = lh->block[i];
   }
   bwrite(buf);
-  brelse(buf);
+}
+
+// Erase log region r's transactions from the log, by breaking
+// its chain at the first header. The header keeps the last
+// sequence number committed, so that after a reboot none is
+// used again and headers left in the regions do not chain on.
+static void
+clear_head(int r)
+{
+  struct logheader empty;
+
+  empty.n = 0;
+  empty.seq = log.done;
+  write_head(r, 0, &empty);
+}
+
+// Copy the blocks of the committed transactions in log region
+// r from the log to their home locations. Returns the sequence
+// number of the last, or 0.
+static uint
+install_from_log(int r)
+{
+  static struct logheader lh;
+  int pos, tail;
+  uint seq;
+
+  seq = 0;
+  for (pos = 0; ; pos += lh.n + 1) {
+    read_head(r, pos, &lh);
+    if (lh.n <= 0 || lh.n > log.size || pos + lh.n + 1 > log.region)
+      break;
+    if (seq != 0 && lh.seq != seq + 1)
+      break;  // left from an earlier use of the region
+    for (tail = 0; tail < lh.n; tail++) {
+      struct buf *lbuf = bread(log.dev, logblock(r, pos+tail+1)); // read log block
+      struct buf *dbuf = bread(log.dev, lh.block[tail]); // read dst
+      memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
+      bwrite(dbuf);  // write dst to disk
+      brelse(lbuf);
+      brelse(dbuf);
+    }
+    seq = lh.seq;
+  }
+  return seq;
 }
 
 static void
 recover_from_log(void)
 {
-  read_head();
-  install_trans(); // if committed, copy from log to disk
-  log.lh.n = 0;
-  write_head(); // clear the log
+  static struct logheader h0, h1;
+  uint s;
+  int first;
+
+  read_head(0, 0, &h0);
+  read_head(1, 0, &h1);
+  first = h1.n > 0 && (h0.n == 0 || h1.seq < h0.seq);
+  log.done = h0.seq > h1.seq ? h0.seq : h1.seq;
+  s = install_from_log(first); // if committed, copy from log to disk
+  if (s > log.done)
+    log.done = s;
+  s = install_from_log(!first);
+  if (s > log.done)
+    log.done = s;
+  log.seq = log.done + 1;
+  clear_head(0);
+  clear_head(1);
 }
 
 // called at the start of each FS system call.
@@ -127,12 +251,19 @@ begin_op(void)
 {
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.freezing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
-      // this op might exhaust log space; wait for commit.
+    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > log.size){
+      // this op might exhaust log space; wait for the
+      // log writer to take the transaction.
+      log.waits++;
+      log.nwait++;
+      wakeup(&log.lh);
       sleep(&log, &log.lock);
+      log.nwait--;
     } else {
+      if(log.lh.n > 0 && ticks - log.opened >= LOGDELAY)
+        wakeup(&log.lh);  // time the transaction was committed
       log.outstanding += 1;
       release(&log.lock);
       break;
@@ -141,69 +272,278 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// waits for the commit of the transaction holding this
+// system call's changes, if it made any.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  uint seq;
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
-  }
+  if(log.outstanding < 0)
+    panic("end_op");
+  // begin_op() may be waiting for log space,
+  // and decrementing log.outstanding has decreased
+  // the amount of reserved space.
+  wakeup(&log);
+  if(log.outstanding == 0)
+    wakeup(&log.lh);  // the log writer may take the transaction
+  seq = myproc()->logseq;
+  myproc()->logseq = 0;
+  while(log.done < seq)
+    sleep(&log.done, &log.lock);
   release(&log.lock);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// Copy the modified blocks of the transaction being committed
+// from cache to the log buffers. log_write() has pinned them in
+// the cache, so there is nothing to read.
+static void
+copy_log(void)
+{
+  int tail;
+
+  for (tail = 0; tail < log.clh.n; tail++) {
+    struct buf *to = log.lbuf[tail]; // log block
+    struct buf *from = bread(log.dev, log.clh.block[tail]); // cache block
+    to->dev = log.dev;
+    to->blockno = logblock(log.cur, log.tail+tail+1);
+    memmove(to->data, from->data, BSIZE);
+    brelse(from);
+  }
+}
+
+// Wait for the writes started on bs[0..n-1] and release them.
+static void
+finish(struct buf **bs, int n)
+{
+  int i;
+
+  for (i = 0; i < n; i++) {
+    bwait(bs[i]);
+    brelse(bs[i]);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the log blocks of the transaction being committed to
+// disk, all at once.
 static void
 write_log(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.clh.n; tail++)
+    bwritestart(log.lbuf[tail]);  // write the log
+  for (tail = 0; tail < log.clh.n; tail++)
+    bwait(log.lbuf[tail]);
+}
+
+// Is block in the open transaction? Caller must hold log.lock.
+static int
+logged(int block)
+{
+  int i;
+
+  for (i = 0; i < log.lh.n; i++)
+    if (log.lh.block[i] == block)
+      return 1;
+  return 0;
+}
+
+// Add the blocks of the transaction just committed to those
+// waiting for a checkpoint.
+static void
+add_ckpt(void)
+{
+  int i, j;
+
+  for (i = 0; i < log.clh.n; i++) {
+    for (j = 0; j < log.nckpt; j++)
+      if (log.ckpt[j] == log.clh.block[i])
+        break;
+    if (j == log.nckpt)
+      log.ckpt[log.nckpt++] = log.clh.block[i];
   }
 }
 
+// Start writing the committed block in locked buffer b to its
+// home location, unless the open transaction has changed it
+// since; then release b and return 0. Holding the buffer keeps
+// system calls from changing the block while it is checked and
+// written.
+static int
+install_start(struct buf *b)
+{
+  int skip;
+
+  bwait(b);
+  acquire(&log.lock);
+  skip = logged(b->blockno);
+  release(&log.lock);
+  if (skip) {
+    brelse(b);
+    return 0;
+  }
+  bwritestart(b);  // write dst to disk
+  return 1;
+}
+
+// Write the blocks committed since the last checkpoint from the
+// cache to their home locations, except those the open
+// transaction has changed since. Returns the number skipped.
+static int
+install_trans(void)
+{
+  static struct buf *bs[LOGMAX];
+  struct buf *dbuf;
+  int i, n, nbusy, written;
+
+  // First the blocks that no one is using, many at a time, and
+  // then the others one at a time: waiting for a buffer while
+  // holding some could wait for a system call that waits for
+  // one of ours. log_write() has pinned the blocks in the
+  // cache, so there is nothing to read.
+  written = 0;
+  n = nbusy = 0;
+  for (i = 0; i < log.nckpt; i++) {
+    if (n == NELEM(bs)) {
+      finish(bs, n);
+      n = 0;
+    }
+    if ((dbuf = bstart(log.dev, log.ckpt[i], 1)) == 0)
+      log.ckpt[nbusy++] = log.ckpt[i];
+    else if (install_start(dbuf))
+      bs[n++] = dbuf;
+  }
+  finish(bs, n);
+  written += n;
+  for (i = 0; i < nbusy; i++) {
+    dbuf = bstart(log.dev, log.ckpt[i], 0);
+    if (install_start(dbuf)) {
+      finish(&dbuf, 1);
+      written++;
+    }
+  }
+  n = log.nckpt - written;
+  log.nckpt = 0;
+  return n;
+}
+
+// Write home the blocks committed since the last checkpoint and
+// go on at the start of a region: the same one, unless blocks
+// were skipped, whose committed versions are only in this one
+// until the transaction changing them commits.
 static void
-commit()
+checkpoint(void)
+{
+  log.ckpts++;
+  if(install_trans() > 0){  // Now install writes to home locations
+    log.pending = log.cur;
+    log.cur = !log.cur;
+  } else
+    clear_head(log.cur);    // Erase the transactions from the log
+  log.tail = 0;
+}
+
+// Should the log writer checkpoint because bget() is out of
+// buffers? Clears the request. Caller must hold log.lock.
+static int
+ckptnow(void)
+{
+  int want;
+
+  // Only blocks committed since the last checkpoint can be
+  // unpinned; there are none while a region is pending.
+  want = log.ckptwant && log.nckpt > 0;
+  log.ckptwant = 0;
+  return want;
+}
+
+// Should the log writer take the open transaction?
+// Caller must hold log.lock.
+static int
+logready(void)
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+  return log.lh.n > 0 &&
+    (log.outstanding == 0 || log.nwait > 0 || ticks - log.opened >= LOGDELAY);
+}
+
+// The log writer: take each transaction and commit it, and
+// checkpoint when the region it goes in is full.
+static void
+logwriter(void *arg)
+{
+  bprivate(log.lbuf, log.size);
+  bprivate(&log.hbuf, 1);
+  recover_from_log();
+  acquire(&log.lock);
+  log.ready = 1;
+  wakeup(&log.ready);
+  release(&log.lock);
+
+  for(;;){
+    acquire(&log.lock);
+    while(!logready()){
+      if(ckptnow()){
+        release(&log.lock);
+        checkpoint();
+        acquire(&log.lock);
+      } else
+        sleep(&log.lh, &log.lock);
+    }
+
+    // Keep new system calls out until those in the transaction
+    // have ended and it has been copied to the log buffers. One
+    // may be waiting for a buffer that only a checkpoint frees.
+    log.freezing = 1;
+    while(log.outstanding > 0){
+      if(ckptnow()){
+        release(&log.lock);
+        checkpoint();
+        acquire(&log.lock);
+      } else
+        sleep(&log.lh, &log.lock);
+    }
+    log.clh = log.lh;
+    log.clh.seq = log.seq++;
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    release(&log.lock);
+    copy_log();
+    acquire(&log.lock);
+    log.freezing = 0;
+    wakeup(&log);
+    release(&log.lock);
+
+    write_log();    // Write modified blocks from cache to log
+    write_head(log.cur, log.tail, &log.clh);  // Write header to disk -- the real commit
+    acquire(&log.lock);
+    log.done = log.clh.seq;
+    log.commits++;
+    wakeup(&log.done);
+    release(&log.lock);
+    add_ckpt();
+    log.tail += log.clh.n + 1;
+
+    // The earlier region's skipped blocks are in this transaction.
+    if(log.pending >= 0)
+      clear_head(log.pending);
+    log.pending = -1;
+
+    // Checkpoint when the region has no room for a transaction
+    // as large as there can be, or bget() is out of buffers.
+    acquire(&log.lock);
+    if(ckptnow() || !LOGDEFER || log.tail + log.size + 1 > log.region){
+      release(&log.lock);
+      checkpoint();
+    } else
+      release(&log.lock);
   }
 }
 
 // Caller has modified b->data and is done with the buffer.
 // Record the block number and pin in the cache with B_DIRTY.
-// commit()/write_log() will do the disk write.
+// The log writer will do the disk write.
 //
 // log_write() replaces bwrite(); a typical use is:
 //   bp = bread(...)
@@ -215,7 +555,7 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.size)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
@@ -226,9 +566,39 @@ log_write(struct buf *b)
       break;
   }
   log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    if (log.lh.n == 0)
+      log.opened = ticks;
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
+  myproc()->logseq = log.seq;
   release(&log.lock);
 }
 
+// Called by bget() when every buffer is in use: blocks waiting
+// for a checkpoint may be what holds them.
+void
+logpressure(void)
+{
+  acquire(&log.lock);
+  if(!log.ckptwant){
+    log.ckptwant = 1;
+    wakeup(&log.lh);
+  }
+  release(&log.lock);
+}
+
+// Report the blocks a transaction may log, the transactions
+// committed, the times system calls waited for log space, and
+// the checkpoints.
+void
+logstat(uint *size, uint *commits, uint *waits, uint *ckpts)
+{
+  acquire(&log.lock);
+  *size = log.size;
+  *commits = log.commits;
+  *waits = log.waits;
+  *ckpts = log.ckpts;
+  release(&log.lock);
+}
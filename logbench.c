@@ -0,0 +1,65 @@
+// Large-file write throughput against the size of the log.
+//
+//   logbench [runs]
+//
+// Writes a file as large as the file system allows runs times
+// (default 3), in 8-Kbyte writes, and prints the time taken, the
+// throughput, the log transactions that carried the writes, how
+// often a write waited for log space, and the disk traffic. The
+// log size is fixed when the file system is made: run make clean
+// and then make LOGSIZE=n to compare sizes. n is the blocks in
+// each of the log's two regions, and a transaction holds up to
+// n-1 of them, but no more than LOGMAX in fs.h.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+#include "meminfo.h"
+
+#define FILENAME "logbench.tmp"
+
+char buf[8192];
+
+int
+main(int argc, char *argv[])
+{
+  struct meminfo m0, m1;
+  int i, j, fd, runs, t;
+  uint kb;
+
+  runs = argc >= 2 ? atoi(argv[1]) : 3;
+  memset(buf, 'l', sizeof(buf));
+  meminfo(&m0);
+  t = uptime();
+  for(i = 0; i < runs; i++){
+    if((fd = open(FILENAME, O_CREATE|O_RDWR)) < 0){
+      printf(2, "logbench: cannot create %s\n", FILENAME);
+      exit();
+    }
+    for(j = 0; j < MAXFILE*BSIZE/sizeof(buf); j++)
+      if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+        printf(2, "logbench: write failed\n");
+        exit();
+      }
+    close(fd);
+    unlink(FILENAME);
+  }
+  t = uptime() - t;
+  meminfo(&m1);
+
+  kb = runs*(MAXFILE*BSIZE/sizeof(buf))*sizeof(buf)/1024;
+  printf(1, "logbench: log of %d blocks, %d Kbytes written\n",
+         m1.logsize, kb);
+  printf(1, "%d ticks, ", t);
+  if(t > 0)
+    printf(1, "%d Kbytes/s\n", kb*100/t);
+  else
+    printf(1, "- Kbytes/s\n");
+  printf(1, "%d commits, %d waits for log space\n",
+         m1.logcommits - m0.logcommits, m1.logwaits - m0.logwaits);
+  printf(1, "%d blocks written in %d commands\n",
+         m1.diskwrites - m0.diskwrites, m1.diskcmds - m0.diskcmds);
+  exit();
+}
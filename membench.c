@@ -0,0 +1,496 @@
+// Memory system benchmarks.
+//
+//   membench exec [n]   time n execs of a large program
+//   membench sh         memory used by 10 concurrent shells
+//   membench ls [n]     time n runs of ls from a shell script
+//   membench fork [n]   pages per forked child, and time for
+//                       n fork/exit/wait round trips
+//   membench tlb [mb]   strided walk over an mb-Mbyte heap,
+//                       with small pages and with superpages
+//   membench switch [n] time n pipe round trips between two
+//                       processes, two context switches each
+//   membench grep [kb]  scan a kb-Kbyte log with read() and
+//                       with mmap(), and time grep over it
+//   membench ipc [kb]   move kb Kbytes from one process to
+//                       another through a pipe and through
+//                       shared memory
+//
+// Times are in clock ticks, memory in 4096-byte pages.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "meminfo.h"
+
+#define NSH 10
+
+// Initialized data that makes this binary big; the "nop"
+// child never touches it, so with demand paging it is
+// never read from disk.
+char bloat[30*1024] = { 1 };
+
+void
+getmeminfo(struct meminfo *mi)
+{
+  if(meminfo(mi) < 0){
+    printf(2, "membench: meminfo failed\n");
+    exit();
+  }
+}
+
+int
+freepages(void)
+{
+  struct meminfo mi;
+
+  getmeminfo(&mi);
+  return mi.freepages;
+}
+
+void
+execbench(int n)
+{
+  char *argv[] = { "membench", "nop", 0 };
+  int i, pid, t0, t1;
+
+  printf(1, "exec: %d execs of membench (%d bytes of data)\n",
+         n, sizeof(bloat));
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "membench: fork failed\n");
+      exit();
+    }
+    if(pid == 0){
+      exec("membench", argv);
+      printf(2, "membench: exec failed\n");
+      exit();
+    }
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "exec: %d ticks total\n", t1 - t0);
+}
+
+void
+shbench(void)
+{
+  char *argv[] = { "sh", 0 };
+  int i, p[2], before, during;
+
+  if(pipe(p) < 0){
+    printf(2, "membench: pipe failed\n");
+    exit();
+  }
+  before = freepages();
+  for(i = 0; i < NSH; i++){
+    if(fork() == 0){
+      // Commands come from a pipe that never delivers any;
+      // prompts go nowhere.
+      close(0);
+      dup(p[0]);
+      close(2);
+      dup(p[0]);
+      close(p[0]);
+      close(p[1]);
+      exec("sh", argv);
+      printf(1, "membench: exec sh failed\n");
+      exit();
+    }
+  }
+  sleep(100);
+  during = freepages();
+  printf(1, "sh: %d shells use %d pages (%d per shell)\n",
+         NSH, before - during, (before - during) / NSH);
+  close(p[0]);
+  close(p[1]);
+  for(i = 0; i < NSH; i++)
+    wait();
+}
+
+void
+lsbench(int n)
+{
+  char *argv[] = { "sh", 0 };
+  char *cmd = "ls > lsbench.out\n";
+  struct meminfo m0, m1;
+  int i, fd, t0, t1;
+
+  fd = open("lsbench.sh", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf(2, "membench: cannot create lsbench.sh\n");
+    exit();
+  }
+  for(i = 0; i < n; i++)
+    write(fd, cmd, strlen(cmd));
+  close(fd);
+
+  getmeminfo(&m0);
+  t0 = uptime();
+  if(fork() == 0){
+    close(0);
+    if(open("lsbench.sh", O_RDONLY) != 0){
+      printf(2, "membench: cannot open lsbench.sh\n");
+      exit();
+    }
+    close(2);
+    open("lsbench.out", O_CREATE|O_WRONLY);
+    exec("sh", argv);
+    printf(1, "membench: exec sh failed\n");
+    exit();
+  }
+  wait();
+  t1 = uptime();
+  getmeminfo(&m1);
+
+  printf(1, "ls: %d runs in %d ticks\n", n, t1 - t0);
+  printf(1, "ls: pages in use %d -> %d, page cache %d pages, "
+         "%d hits %d misses\n",
+         m0.totalpages - m0.freepages, m1.totalpages - m1.freepages,
+         m1.cachepages, m1.cachehits - m0.cachehits,
+         m1.cachemisses - m0.cachemisses);
+  unlink("lsbench.sh");
+  unlink("lsbench.out");
+}
+
+void
+forkbench(int n)
+{
+  int i, pid, t0, t1, p[2], before, during;
+  char c;
+
+  // Memory per process: children that block reading a pipe.
+  if(pipe(p) < 0){
+    printf(2, "membench: pipe failed\n");
+    exit();
+  }
+  before = freepages();
+  for(i = 0; i < NSH; i++){
+    if(fork() == 0){
+      close(p[1]);
+      read(p[0], &c, 1);
+      exit();
+    }
+  }
+  during = freepages();
+  close(p[0]);
+  close(p[1]);
+  for(i = 0; i < NSH; i++)
+    wait();
+  printf(1, "fork: %d children use %d pages (%d per child)\n",
+         NSH, before - during, (before - during) / NSH);
+
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    pid = fork();
+    if(pid < 0){
+      printf(2, "membench: fork failed\n");
+      exit();
+    }
+    if(pid == 0)
+      exit();
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "fork: %d forks in %d ticks\n", n, t1 - t0);
+}
+
+// Touch one word in every page of an mb-Mbyte heap, many times
+// over, so that nearly every access misses in the TLB unless
+// the heap is mapped with superpages.
+void
+tlbwalk(int mb, int super)
+{
+  char *a;
+  int i, pass, t0, t1;
+  uint sum, sz;
+
+  superpages(super);
+  sz = mb * 1024 * 1024;
+  // Start the heap on a 4-Mbyte boundary so superpages can be used.
+  sbrk(4*1024*1024 - ((uint)sbrk(0) % (4*1024*1024)));
+  a = sbrk(sz);
+  if(a == (char*)-1){
+    printf(2, "membench: sbrk %d failed\n", sz);
+    exit();
+  }
+  sum = 0;
+  t0 = uptime();
+  for(pass = 0; pass < 200; pass++)
+    for(i = 0; i < sz; i += 4096)
+      sum += a[i]++;
+  t1 = uptime();
+  printf(1, "tlb: %d Mbytes, %s pages: %d ticks (%d)\n",
+         mb, super ? "super" : "small", t1 - t0, sum);
+}
+
+void
+tlbbench(int mb)
+{
+  if(fork() == 0){
+    tlbwalk(mb, 0);
+    exit();
+  }
+  wait();
+  if(fork() == 0){
+    tlbwalk(mb, 1);
+    exit();
+  }
+  wait();
+}
+
+// Bounce a byte between parent and child over two pipes. Each
+// round trip switches address space twice; the child keeps a
+// working set of kb Kbytes, which it rewalks after every switch
+// to show the cost of refilling the TLB.
+void
+switchbench(int n)
+{
+  int i, j, t0, t1, p1[2], p2[2], kb;
+  char c, *a;
+
+  kb = 64;
+  if(pipe(p1) < 0 || pipe(p2) < 0){
+    printf(2, "membench: pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    a = sbrk(kb * 1024);
+    for(i = 0; i < n; i++){
+      if(read(p1[0], &c, 1) != 1)
+        break;
+      for(j = 0; j < kb * 1024; j += 4096)
+        a[j]++;
+      write(p2[1], &c, 1);
+    }
+    exit();
+  }
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    write(p1[1], "x", 1);
+    if(read(p2[0], &c, 1) != 1){
+      printf(2, "membench: read failed\n");
+      break;
+    }
+  }
+  t1 = uptime();
+  wait();
+  printf(1, "switch: %d round trips in %d ticks\n", n, t1 - t0);
+  close(p1[0]);
+  close(p1[1]);
+  close(p2[0]);
+  close(p2[1]);
+}
+
+// Count newlines in fd by reading it a block at a time.
+int
+scanread(int fd)
+{
+  static char buf[4096];
+  int i, n, lines;
+
+  lines = 0;
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    for(i = 0; i < n; i++)
+      lines += buf[i] == '\n';
+  return lines;
+}
+
+// Count newlines in fd by mapping it.
+int
+scanmap(int fd, int size)
+{
+  char *a;
+  int i, lines;
+
+  if((a = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0)) == (char*)-1){
+    printf(2, "membench: mmap failed\n");
+    exit();
+  }
+  lines = 0;
+  for(i = 0; i < size; i++)
+    lines += a[i] == '\n';
+  munmap(a, size);
+  return lines;
+}
+
+void
+grepbench(int kb)
+{
+  char *argv[] = { "grep", "ERROR", "grepbench.log", 0 };
+  char *line;
+  int i, fd, size, lines, pass, t0, t1, t2;
+
+  fd = open("grepbench.log", O_CREATE|O_WRONLY);
+  if(fd < 0){
+    printf(2, "membench: cannot create grepbench.log\n");
+    exit();
+  }
+  // One line in a hundred matches.
+  for(size = 0, i = 0; ; size += strlen(line), i++){
+    line = i % 100 ? "INFO all is well\n" : "ERROR disk on fire\n";
+    if(size + strlen(line) > kb * 1024)
+      break;
+    write(fd, line, strlen(line));
+  }
+  close(fd);
+
+  lines = 0;
+  t0 = uptime();
+  for(pass = 0; pass < 20; pass++){
+    fd = open("grepbench.log", O_RDONLY);
+    lines += scanread(fd);
+    close(fd);
+  }
+  t1 = uptime();
+  for(pass = 0; pass < 20; pass++){
+    fd = open("grepbench.log", O_RDONLY);
+    lines -= scanmap(fd, size);
+    close(fd);
+  }
+  t2 = uptime();
+  if(lines != 0)
+    printf(2, "membench: read and mmap disagree\n");
+  printf(1, "grep: 20 scans of %d bytes: read %d ticks, mmap %d ticks\n",
+         size, t1 - t0, t2 - t1);
+
+  t0 = uptime();
+  for(i = 0; i < 10; i++){
+    if(fork() == 0){
+      close(1);
+      open("grepbench.out", O_CREATE|O_WRONLY);
+      exec("grep", argv);
+      printf(2, "membench: exec grep failed\n");
+      exit();
+    }
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "grep: 10 runs of grep ERROR in %d ticks\n", t1 - t0);
+  unlink("grepbench.log");
+  unlink("grepbench.out");
+}
+
+#define NSLOT 8
+
+// A ring of NSLOT page-sized slots in a shared segment. The
+// producer fills slot k % NSLOT in place and sets its full
+// flag; the consumer reads it in place and clears the flag.
+struct ring {
+  volatile int full[NSLOT];
+};
+
+uint
+ipcpipe(int n)
+{
+  static char buf[4096];
+  int i, j, p[2];
+  uint sum;
+
+  if(pipe(p) < 0){
+    printf(2, "membench: pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    close(p[0]);
+    for(i = 0; i < n; i++){
+      memset(buf, i, sizeof(buf));
+      write(p[1], buf, sizeof(buf));
+    }
+    exit();
+  }
+  close(p[1]);
+  sum = 0;
+  while((i = read(p[0], buf, sizeof(buf))) > 0)
+    for(j = 0; j < i; j++)
+      sum += (uchar)buf[j];
+  close(p[0]);
+  wait();
+  return sum;
+}
+
+uint
+ipcshm(int n)
+{
+  struct ring *r;
+  char *data;
+  int i, j, slot;
+  uint sum;
+
+  r = shmat("ipcbench", (NSLOT+1)*4096);
+  if(r == (struct ring*)-1){
+    printf(2, "membench: shmat failed\n");
+    exit();
+  }
+  data = (char*)r + 4096;
+  if(fork() == 0){
+    for(i = 0; i < n; i++){
+      slot = i % NSLOT;
+      while(r->full[slot])
+        shmwait((int*)&r->full[slot], 1);
+      memset(data + slot*4096, i, 4096);
+      r->full[slot] = 1;
+      shmwake((int*)&r->full[slot]);
+    }
+    exit();
+  }
+  sum = 0;
+  for(i = 0; i < n; i++){
+    slot = i % NSLOT;
+    while(!r->full[slot])
+      shmwait((int*)&r->full[slot], 0);
+    for(j = 0; j < 4096; j++)
+      sum += (uchar)data[slot*4096 + j];
+    r->full[slot] = 0;
+    shmwake((int*)&r->full[slot]);
+  }
+  wait();
+  shmdt(r);
+  return sum;
+}
+
+void
+ipcbench(int kb)
+{
+  int n, t0, t1, t2;
+  uint s1, s2;
+
+  n = kb / 4;
+  t0 = uptime();
+  s1 = ipcpipe(n);
+  t1 = uptime();
+  s2 = ipcshm(n);
+  t2 = uptime();
+  if(s1 != s2)
+    printf(2, "membench: pipe and shm sums differ\n");
+  printf(1, "ipc: %d Kbytes: pipe %d ticks, shared memory %d ticks\n",
+         n * 4, t1 - t0, t2 - t1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc >= 2 && strcmp(argv[1], "nop") == 0)
+    exit();
+  if(argc >= 2 && strcmp(argv[1], "exec") == 0)
+    execbench(argc >= 3 ? atoi(argv[2]) : 100);
+  else if(argc >= 2 && strcmp(argv[1], "sh") == 0)
+    shbench();
+  else if(argc >= 2 && strcmp(argv[1], "ls") == 0)
+    lsbench(argc >= 3 ? atoi(argv[2]) : 50);
+  else if(argc >= 2 && strcmp(argv[1], "fork") == 0)
+    forkbench(argc >= 3 ? atoi(argv[2]) : 1000);
+  else if(argc >= 2 && strcmp(argv[1], "tlb") == 0)
+    tlbbench(argc >= 3 ? atoi(argv[2]) : 16);
+  else if(argc >= 2 && strcmp(argv[1], "switch") == 0)
+    switchbench(argc >= 3 ? atoi(argv[2]) : 10000);
+  else if(argc >= 2 && strcmp(argv[1], "grep") == 0)
+    grepbench(argc >= 3 ? atoi(argv[2]) : 64);
+  else if(argc >= 2 && strcmp(argv[1], "ipc") == 0)
+    ipcbench(argc >= 3 ? atoi(argv[2]) : 16384);
+  else
+    printf(2, "usage: membench exec|sh|ls|fork|tlb|switch|grep|ipc [n]\n");
+  exit();
+}
@@ -13,16 +13,17 @@
 #include "fs.h"
 #include "buf.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_memfs_img_start[], _binary_memfs_img_size[];
 
 static int disksize;
 static uchar *memdisk;
+static uint idereads, idewrites;
 
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_memfs_img_start;
+  disksize = (uint)_binary_memfs_img_size/BSIZE;
 }
 
 // Interrupt handler.
@@ -32,6 +33,14 @@ ideintr(void)
   // no-op
 }
 
+// Nor is there a virtio disk.
+int virtioirq = -1;
+
+void
+virtiointr(void)
+{
+}
+
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
@@ -52,9 +61,53 @@ iderw(struct buf *b)
   p = memdisk + b->blockno*BSIZE;
 
   if(b->flags & B_DIRTY){
+    idewrites++;
     b->flags &= ~B_DIRTY;
     memmove(p, b->data, BSIZE);
-  } else
+  } else {
+    idereads++;
     memmove(b->data, p, BSIZE);
+  }
   b->flags |= B_VALID;
 }
+
+// The memory disk is never busy: do the transfer now.
+void
+idesubmit(struct buf *b)
+{
+  void (*iodone)(struct buf*);
+
+  iderw(b);
+  iodone = b->iodone;
+  b->iodone = 0;
+  if(iodone)
+    iodone(b);
+}
+
+void
+ideiowait(struct buf *b)
+{
+}
+
+// One command per block, and nothing to seek. The copying is
+// not counted as driver time.
+void
+idestat(uint *reads, uint *writes, uint *cmds, uint *seek, uint *kcycles)
+{
+  *reads = idereads;
+  *writes = idewrites;
+  *cmds = idereads + idewrites;
+  *seek = 0;
+  *kcycles = 0;
+}
+
+struct buf*
+ideiowaitany(struct buf **bs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(bs[i])
+      return bs[i];
+  return 0;
+}
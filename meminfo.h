@@ -0,0 +1,41 @@
+// System-wide memory statistics, filled in by the meminfo() system call.
+struct meminfo {
+  uint freepages;   // pages on the kalloc free list
+  uint totalpages;  // pages managed by kalloc
+  uint cachepages;  // pages held by the page cache
+  uint cachehits;   // page cache lookups that found the page
+  uint cachemisses; // page cache lookups that read the file
+  uint swapslots;   // pages of swap space
+  uint swapused;    // swap slots holding pages
+  uint swapouts;    // pages written to swap
+  uint swapins;     // pages read back from swap
+  uint freeblocks[11]; // free blocks of 2^i pages (NORDER in param.h)
+  uint bufs;        // buffers in the disk block cache
+  uint bufhits;     // block lookups that found the block cached
+  uint bufmisses;   // block lookups that had to read it
+  uint diskreads;   // blocks read from disk
+  uint diskwrites;  // blocks written to disk
+  uint diskcmds;    // disk commands, each moving consecutive blocks
+  uint diskseek;    // blocks the disk head moved between commands
+  uint diskcpu;     // CPU time in the disk driver, in 1024 cycles
+  uint logsize;     // blocks a log transaction may hold
+  uint logcommits;  // log transactions committed
+  uint logwaits;    // system calls that waited for log space
+  uint logckpts;    // times committed blocks were written home
+};
+
+// Per-process memory use, filled in by the procmem() system call.
+// Threads sharing an address space report its pages only in the
+// entry of the process that created them; the others show 0.
+struct procmem {
+  int pid;
+  char name[16];
+  uint sz;          // bytes of address space below the heap top
+  uint rss;         // resident user pages
+  uint shared;      // resident pages also mapped elsewhere
+  uint zero;        // untouched pages mapped to the zero page
+  uint swapped;     // pages in swap
+  uint ptpages;     // page directory and page table pages
+  uint kstack;      // kernel stack pages
+  uint rsslimit;    // limit on rss+zero set by rsslimit(), 0 if none
+};
@@ -0,0 +1,62 @@
+// Show where physical memory has gone, or limit a process.
+//
+//   memstat                    per-process pages and totals
+//   memstat limit pid npages   limit pid to npages resident
+//                              pages when it grows; 0 removes
+//                              the limit
+//
+// Counts are in 4-Kbyte pages. Pages shared between processes
+// (after fork, or mapped from the same file or segment) count
+// toward each of them, so the totals split memory into private
+// user pages, page tables and kernel stacks, and the rest:
+// shared pages and the kernel's other allocations.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "meminfo.h"
+
+struct procmem pm[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  struct meminfo mi;
+  int i, n, old;
+  uint private, pt, kstack, other;
+
+  if(argc == 4 && strcmp(argv[1], "limit") == 0){
+    if((old = rsslimit(atoi(argv[2]), atoi(argv[3]))) < 0){
+      printf(2, "memstat: no process %s\n", argv[2]);
+      exit();
+    }
+    printf(1, "pid %s: limit %d pages, was %d\n", argv[2],
+           atoi(argv[3]), old);
+    exit();
+  }
+  if(argc != 1){
+    printf(2, "usage: memstat [limit pid npages]\n");
+    exit();
+  }
+
+  n = procmem(pm, NPROC);
+  meminfo(&mi);
+  printf(1, "pid\tname\tKbytes\trss\tshared\tzero\tswap\tptab\tkstack\tlimit\n");
+  private = pt = kstack = 0;
+  for(i = 0; i < n; i++){
+    printf(1, "%d\t%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n", pm[i].pid,
+           pm[i].name, pm[i].sz / 1024, pm[i].rss, pm[i].shared,
+           pm[i].zero, pm[i].swapped, pm[i].ptpages, pm[i].kstack,
+           pm[i].rsslimit);
+    private += pm[i].rss - pm[i].shared;
+    pt += pm[i].ptpages;
+    kstack += pm[i].kstack;
+  }
+  other = mi.totalpages - mi.freepages - mi.cachepages - private - pt -
+          kstack;
+  printf(1, "total %d: free %d, page cache %d, private user %d, "
+         "page tables %d, kernel stacks %d, other %d\n", mi.totalpages,
+         mi.freepages, mi.cachepages, private, pt, kstack, other);
+  exit();
+}
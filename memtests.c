@@ -0,0 +1,717 @@
+// Tests for the memory system: demand paging, sharing,
+// superpages, mmap, shared memory, threads, futexes, memory
+// accounting, stack growth. Kept apart from usertests, which is already
+// close to the largest file the file system can hold.
+
+#include "param.h"
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "memlayout.h"
+#include "futex.h"
+#include "meminfo.h"
+
+int stdout = 1;
+
+// demand-loaded data pages are shared with a forked child
+// until written; a write in one must not show in the other.
+char initdata[8192] = "initialized";
+
+void
+sharetest(void)
+{
+  int pid;
+
+  printf(stdout, "share test\n");
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(strcmp(initdata, "initialized") != 0){
+      printf(stdout, "share test: child saw wrong data\n");
+      exit();
+    }
+    initdata[0] = 'X';
+    initdata[4096] = 'Y';
+    exit();
+  }
+  wait();
+  if(initdata[0] != 'i' || initdata[4096] != 0){
+    printf(stdout, "share test failed\n");
+    exit();
+  }
+  initdata[0] = 'I';
+  if(initdata[0] != 'I'){
+    printf(stdout, "share test: write lost\n");
+    exit();
+  }
+  printf(stdout, "share test ok\n");
+}
+
+// can a superpage heap be written, inherited by fork, and freed?
+void
+superpagetest(void)
+{
+  char *oldbrk, *a;
+  int i, pid, big;
+
+  printf(stdout, "superpage test\n");
+  big = 8*1024*1024;
+  oldbrk = sbrk(0);
+  superpages(1);
+  sbrk(4*1024*1024 - ((uint)oldbrk % (4*1024*1024)));
+  a = sbrk(big);
+  if(a == (char*)0xffffffff){
+    printf(stdout, "superpage sbrk failed\n");
+    exit();
+  }
+  for(i = 0; i < big; i += 4096)
+    a[i] = i >> 12;
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "superpage fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < big; i += 4096){
+      if(a[i] != (char)(i >> 12)){
+        printf(stdout, "superpage test: child saw wrong data\n");
+        exit();
+      }
+    }
+    a[0] = 99;
+    exit();
+  }
+  wait();
+  if(a[0] != 0){
+    printf(stdout, "superpage test: child write visible\n");
+    exit();
+  }
+  superpages(0);
+  sbrk(-(sbrk(0) - oldbrk));
+  if(sbrk(0) != oldbrk){
+    printf(stdout, "superpage test: shrink failed\n");
+    exit();
+  }
+  printf(stdout, "superpage test ok\n");
+}
+
+// anonymous mappings: private ones are copied by fork,
+// shared ones are not, even pages first touched after the
+// fork; unmapped memory faults.
+void
+mmapanontest(void)
+{
+  char *p, *s;
+  int pid;
+
+  printf(stdout, "mmap anon test\n");
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+  s = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANON, -1, 0);
+  if(p == (char*)-1 || s == (char*)-1){
+    printf(stdout, "mmap anon failed\n");
+    exit();
+  }
+  if(p[0] != 0 || p[2*4096] != 0 || s[100] != 0){
+    printf(stdout, "mmap anon: not zero\n");
+    exit();
+  }
+  p[0] = 'p';
+  s[0] = 's';
+  pid = fork();
+  if(pid < 0){
+    printf(stdout, "mmap anon: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    if(p[0] != 'p' || s[0] != 's'){
+      printf(stdout, "mmap anon: child saw wrong data\n");
+      exit();
+    }
+    p[0] = 'c';
+    s[0] = 'c';
+    s[4096] = 'c';
+    exit();
+  }
+  wait();
+  if(p[0] != 'p' || s[0] != 'c' || s[4096] != 'c'){
+    printf(stdout, "mmap anon: private %c shared %c %c\n",
+           p[0], s[0], s[4096]);
+    exit();
+  }
+  // Punch a hole in the middle.
+  if(munmap(p + 4096, 4096) < 0 || p[0] != 'p'){
+    printf(stdout, "mmap anon: munmap failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    p[4096] = 1;
+    printf(stdout, "mmap anon: unmapped page is writable\n");
+    exit();
+  }
+  wait();
+  if(munmap(p, 3*4096) < 0 || munmap(s, 2*4096) < 0){
+    printf(stdout, "mmap anon: munmap failed\n");
+    exit();
+  }
+  printf(stdout, "mmap anon test ok\n");
+}
+
+// file mappings: private writes stay private, shared writes
+// reach the file when unmapped and read() at once, write()s
+// appending to the last page show in a shared mapping, and
+// read() can fill a mapping.
+void
+mmapfiletest(void)
+{
+  char *p, buf[16];
+  int fd, fd1, i, pid;
+
+  printf(stdout, "mmap file test\n");
+  unlink("mmapfile");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "mmap file: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 830; i++)
+    write(fd, "0123456789", 10);
+
+  // 8300 bytes: two pages and 108 bytes.
+  p = mmap(0, 3*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == (char*)-1 || p[4096] != '6' || p[2*4096+107] != '9' ||
+     p[2*4096+108] != 0){
+    printf(stdout, "mmap file: bad private mapping\n");
+    exit();
+  }
+  p[0] = 'X';
+  munmap(p, 3*4096);
+
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 4096);
+  if(p == (char*)-1 || p[0] != '6'){
+    printf(stdout, "mmap file: bad shared mapping\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    p[1] = 'Y';
+    exit();
+  }
+  wait();
+  p[2] = 'Z';
+  fd1 = open("mmapfile", O_RDONLY);
+  for(i = 0; i < 4096; i += 16)
+    read(fd1, buf, 16);
+  if(read(fd1, buf, 3) != 3 || buf[1] != 'Y' || buf[2] != 'Z'){
+    printf(stdout, "mmap file: read missed shared writes\n");
+    exit();
+  }
+  close(fd1);
+  if(p[4096] != '2' || write(fd, "abc", 3) != 3 || p[4096+108] != 'a'){
+    printf(stdout, "mmap file: append missing from shared mapping\n");
+    exit();
+  }
+  if(munmap(p, 2*4096) < 0){
+    printf(stdout, "mmap file: munmap failed\n");
+    exit();
+  }
+  close(fd);
+
+  fd = open("mmapfile", O_RDONLY);
+  if(read(fd, buf, 1) != 1 || buf[0] != '0'){
+    printf(stdout, "mmap file: private write reached file\n");
+    exit();
+  }
+  p = mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 4096);
+  if(p == (char*)-1 || p[1] != 'Y' || p[2] != 'Z'){
+    printf(stdout, "mmap file: shared writes lost\n");
+    exit();
+  }
+  // The kernel must not write to a read-only mapping.
+  if(read(fd, p, 10) != -1){
+    printf(stdout, "mmap file: read into read-only mapping\n");
+    exit();
+  }
+  munmap(p, 4096);
+  close(fd);
+  unlink("mmapfile");
+  printf(stdout, "mmap file test ok\n");
+}
+
+// a segment attached by unrelated processes is the same
+// memory, survives until the last detach, and shmwait()
+// sleeps until shmwake().
+void
+shmtest(void)
+{
+  int *a, *b, pid;
+
+  printf(stdout, "shm test\n");
+  a = shmat("shmtest", 2*4096);
+  if(a == (int*)-1){
+    printf(stdout, "shmat failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    // Detach the inherited copy and attach afresh, as an
+    // unrelated process would.
+    shmdt(a);
+    b = shmat("shmtest", 4096);
+    if(b == (int*)-1){
+      printf(stdout, "shm test: child attach failed\n");
+      exit();
+    }
+    while(b[0] == 0)
+      shmwait(&b[0], 0);
+    b[1] = b[0] + 1;
+    shmwake(&b[1]);
+    exit();
+  }
+  a[0] = 41;
+  shmwake(&a[0]);
+  while(a[1] == 0)
+    shmwait(&a[1], 0);
+  wait();
+  if(a[1] != 42){
+    printf(stdout, "shm test: got %d\n", a[1]);
+    exit();
+  }
+  if(shmat("shmtest", 3*4096) != (void*)-1){
+    printf(stdout, "shm test: attached past end of segment\n");
+    exit();
+  }
+  if(shmdt(a) < 0 || shmdt(a) != -1){
+    printf(stdout, "shm test: shmdt failed\n");
+    exit();
+  }
+  // The last detach freed it: a new one is zeroed.
+  a = shmat("shmtest", 4096);
+  if(a == (int*)-1 || a[1] != 0){
+    printf(stdout, "shm test: segment not freed\n");
+    exit();
+  }
+  shmdt(a);
+  printf(stdout, "shm test ok\n");
+}
+
+#define NTHREAD 4
+
+lock_t countlock;
+int count;
+char *threadmem[NTHREAD];
+
+void
+counter(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    lock_acquire(&countlock);
+    count++;
+    lock_release(&countlock);
+  }
+  // Memory a thread allocates belongs to all of them.
+  threadmem[(int)arg] = sbrk(4096);
+  threadmem[(int)arg][0] = (int)arg;
+  exit();
+}
+
+// threads share memory, see each other's sbrk(), and are
+// reaped by join() but not by wait().
+void
+threadtest(void)
+{
+  int i, n;
+
+  printf(stdout, "thread test\n");
+  lock_init(&countlock);
+  for(i = 0; i < NTHREAD; i++){
+    if(thread_create(counter, (void*)i) < 0){
+      printf(stdout, "thread_create failed\n");
+      exit();
+    }
+  }
+  if(wait() != -1){
+    printf(stdout, "thread test: wait returned a thread\n");
+    exit();
+  }
+  for(n = 0; thread_join() > 0; n++)
+    ;
+  if(n != NTHREAD || count != NTHREAD*1000){
+    printf(stdout, "thread test: joined %d, count %d\n", n, count);
+    exit();
+  }
+  for(i = 0; i < NTHREAD; i++){
+    if(threadmem[i][0] != i){
+      printf(stdout, "thread test: lost thread memory\n");
+      exit();
+    }
+  }
+  printf(stdout, "thread test ok\n");
+}
+
+#define NFAULTPG 64
+
+char *faultmem;
+
+void
+faulter(void *arg)
+{
+  int i, t;
+
+  t = (int)arg;
+  for(i = 0; i < NFAULTPG; i++)
+    ((int*)(faultmem + i*4096))[t] = t + i;
+  exit();
+}
+
+// threads that write the same fresh heap pages at once each
+// fault them in, and none loses the others' writes.
+void
+threadfaulttest(void)
+{
+  int i, t;
+
+  printf(stdout, "thread fault test\n");
+  faultmem = sbrk(NFAULTPG*4096);
+  for(t = 0; t < NTHREAD; t++){
+    if(thread_create(faulter, (void*)t) < 0){
+      printf(stdout, "thread_create failed\n");
+      exit();
+    }
+  }
+  while(thread_join() > 0)
+    ;
+  for(i = 0; i < NFAULTPG; i++){
+    for(t = 0; t < NTHREAD; t++){
+      if(((int*)(faultmem + i*4096))[t] != t + i){
+        printf(stdout, "thread fault test: lost a write\n");
+        exit();
+      }
+    }
+  }
+  sbrk(-NFAULTPG*4096);
+  printf(stdout, "thread fault test ok\n");
+}
+
+char *volatile racemem;
+volatile int racedone;
+int racefds[2], racefd;
+
+void
+racer(void *arg)
+{
+  char *p;
+  int pending;
+
+  // A byte at a time, so that a failed call moves nothing and
+  // the pipe never fills.
+  pending = 0;
+  while(!racedone){
+    if((p = racemem) == 0)
+      continue;
+    if(!pending && write(racefds[1], p, 1) == 1)
+      pending = 1;
+    if(pending && read(racefds[0], p, 1) == 1)
+      pending = 0;
+    fstat(racefd, (struct stat*)p);
+  }
+  exit();
+}
+
+// a thread copying through a buffer that another thread unmaps
+// gets an error from the system call, not a kernel fault.
+void
+unmapracetest(void)
+{
+  int i;
+  char *p;
+
+  printf(stdout, "unmap race test\n");
+  if(pipe(racefds) < 0 || (racefd = open("README", O_RDONLY)) < 0){
+    printf(stdout, "unmap race test: pipe or open failed\n");
+    exit();
+  }
+  racedone = 0;
+  if(thread_create(racer, 0) < 0){
+    printf(stdout, "thread_create failed\n");
+    exit();
+  }
+  for(i = 0; i < 500; i++){
+    p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANON, -1, 0);
+    if(p == (char*)-1){
+      printf(stdout, "unmap race test: mmap failed\n");
+      exit();
+    }
+    racemem = p;
+    sleep(0);
+    racemem = 0;
+    munmap(p, 4096);
+  }
+  racedone = 1;
+  thread_join();
+  close(racefds[0]);
+  close(racefds[1]);
+  close(racefd);
+  printf(stdout, "unmap race test ok\n");
+}
+
+mutex_t qlock;
+cond_t qcond;
+int qlen, qsum;
+
+void
+consumer(void *arg)
+{
+  int i;
+
+  for(i = 0; i < 1000; i++){
+    mutex_lock(&qlock);
+    while(qlen == 0)
+      cond_wait(&qcond, &qlock);
+    qlen--;
+    qsum++;
+    cond_broadcast(&qcond);
+    mutex_unlock(&qlock);
+  }
+  exit();
+}
+
+// futex() sleeps only while the word holds the expected value,
+// and the mutexes and condition variables built on it hand off
+// between threads.
+void
+futextest(void)
+{
+  int i, word;
+
+  printf(stdout, "futex test\n");
+  word = 1;
+  if(futex(&word, FUTEX_WAIT, 0) != -1 ||
+     futex(&word, FUTEX_WAKE, 1) != 0){
+    printf(stdout, "futex test: bad wait or wake\n");
+    exit();
+  }
+  mutex_init(&qlock);
+  cond_init(&qcond);
+  for(i = 0; i < 2; i++){
+    if(thread_create(consumer, 0) < 0){
+      printf(stdout, "thread_create failed\n");
+      exit();
+    }
+  }
+  // Produce 2000 items through a queue of at most 3.
+  for(i = 0; i < 2000; i++){
+    mutex_lock(&qlock);
+    while(qlen == 3)
+      cond_wait(&qcond, &qlock);
+    qlen++;
+    cond_broadcast(&qcond);
+    mutex_unlock(&qlock);
+  }
+  while(thread_join() > 0)
+    ;
+  if(qsum != 2000 || qlen != 0 || qlock.state != 0){
+    printf(stdout, "futex test: sum %d len %d\n", qsum, qlen);
+    exit();
+  }
+  printf(stdout, "futex test ok\n");
+}
+
+struct procmem pmtab[NPROC];
+
+// Find this process in procmem()'s table.
+struct procmem*
+mymem(void)
+{
+  int i, n, pid;
+
+  n = procmem(pmtab, NPROC);
+  pid = getpid();
+  for(i = 0; i < n; i++)
+    if(pmtab[i].pid == pid)
+      return &pmtab[i];
+  printf(stdout, "procmem: pid %d missing\n", pid);
+  exit();
+}
+
+// procmem() counts a process's pages as it grows and touches
+// its heap, and sbrk() fails once growth would take it past
+// the limit set by rsslimit(), which fork() passes on.
+void
+rsslimittest(void)
+{
+  struct procmem *pm;
+  uint rss, zero, limit;
+  char *p;
+  int i;
+
+  printf(stdout, "rsslimit test\n");
+  if(fork() == 0){
+    pm = mymem();
+    if(pm->rss == 0 || pm->ptpages < 2 || pm->kstack != 1 ||
+       pm->rsslimit != 0){
+      printf(stdout, "procmem: rss %d ptpages %d kstack %d\n",
+             pm->rss, pm->ptpages, pm->kstack);
+      exit();
+    }
+    rss = pm->rss;
+    zero = pm->zero;
+    limit = rss + zero + 16;
+    if(rsslimit(0, limit) != 0 || rsslimit(0, -1) != limit){
+      printf(stdout, "rsslimit: limit not set\n");
+      exit();
+    }
+    if((p = sbrk(8*4096)) == (char*)-1){
+      printf(stdout, "rsslimit: sbrk under the limit failed\n");
+      exit();
+    }
+    pm = mymem();
+    if(pm->zero < zero + 8){
+      printf(stdout, "procmem: zero %d, was %d\n", pm->zero, zero);
+      exit();
+    }
+    for(i = 0; i < 8; i++)
+      p[i*4096] = i;
+    pm = mymem();
+    if(pm->rss < rss + 8){
+      printf(stdout, "procmem: rss %d, was %d\n", pm->rss, rss);
+      exit();
+    }
+    if(sbrk(16*4096) != (char*)-1){
+      printf(stdout, "rsslimit: sbrk past the limit succeeded\n");
+      exit();
+    }
+    if(sbrk(-8*4096) == (char*)-1 || sbrk(12*4096) == (char*)-1){
+      printf(stdout, "rsslimit: sbrk after shrinking failed\n");
+      exit();
+    }
+    if(fork() == 0){
+      if(rsslimit(0, -1) != limit)
+        printf(stdout, "rsslimit: not inherited\n");
+      exit();
+    }
+    wait();
+    rsslimit(0, 0);
+    if(sbrk(64*4096) == (char*)-1){
+      printf(stdout, "rsslimit: sbrk after removing the limit failed\n");
+      exit();
+    }
+    printf(stdout, "rsslimit test ok\n");
+    exit();
+  }
+  wait();
+}
+
+// Recurse n deep with a kilobyte of stack per call.
+int
+stackdepth(int n)
+{
+  volatile int frame[256];
+
+  frame[0] = n;
+  if(n == 0)
+    return 0;
+  return stackdepth(n - 1) + 1 + frame[0] - n;
+}
+
+// The stack grows on demand well past its first page, and
+// recursion that never ends runs into the guard page below
+// it and kills the process rather than corrupting its data.
+void
+stacktest(void)
+{
+  int fds[2], n;
+
+  printf(stdout, "stack test\n");
+  if(pipe(fds) < 0){
+    printf(stdout, "pipe failed\n");
+    exit();
+  }
+  if(fork() == 0){
+    close(fds[0]);
+    n = stackdepth(200);
+    write(fds[1], &n, sizeof(n));
+    n = stackdepth(4*MAXUSTACK);
+    write(fds[1], &n, sizeof(n));
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], &n, sizeof(n)) != sizeof(n) || n != 200){
+    printf(stdout, "stack test: 200-Kbyte recursion failed\n");
+    exit();
+  }
+  if(read(fds[0], &n, sizeof(n)) != 0){
+    printf(stdout, "stack test: overflow not caught\n");
+    exit();
+  }
+  close(fds[0]);
+  wait();
+  printf(stdout, "stack test ok\n");
+}
+
+// System calls given addresses in the stack's guard page,
+// which lies below sz but is never mapped, fail rather than
+// fault in the kernel.
+void
+guardtest(char *guard)
+{
+  char *args[2];
+  int fd;
+
+  printf(stdout, "guard test\n");
+  if(exec(guard, args) >= 0 || open(guard, O_RDONLY) >= 0){
+    printf(stdout, "guard test: path in guard page accepted\n");
+    exit();
+  }
+  args[0] = guard;
+  args[1] = 0;
+  if(exec("echo", args) >= 0){
+    printf(stdout, "guard test: argument in guard page accepted\n");
+    exit();
+  }
+  if((fd = open("guardtest.tmp", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "guard test: create failed\n");
+    exit();
+  }
+  if(write(fd, guard, 16) >= 0 || read(fd, guard, 16) >= 0){
+    printf(stdout, "guard test: buffer in guard page accepted\n");
+    exit();
+  }
+  close(fd);
+  unlink("guardtest.tmp");
+  printf(stdout, "guard test ok\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  char *guard;
+
+  // exec() put the stack, and below it the guard page, just
+  // under the first heap address.
+  guard = sbrk(0) - (MAXUSTACK+1)*4096;
+
+  printf(1, "memtests starting\n");
+
+  sharetest();
+  superpagetest();
+  mmapanontest();
+  mmapfiletest();
+  shmtest();
+  threadtest();
+  threadfaulttest();
+  unmapracetest();
+  futextest();
+  rsslimittest();
+  stacktest();
+  guardtest(guard);
+
+  printf(1, "ALL MEMORY TESTS PASSED\n");
+  exit();
+}
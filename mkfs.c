@@ -18,11 +18,12 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks |
+//   swap area ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog;     // Number of log blocks: two regions, committed in turn
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -67,7 +68,7 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, cc, fd, logsize, nswap;
   uint rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
@@ -76,10 +77,32 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
+  logsize = LOGSIZE;
+  nswap = NSWAP;
+  for(;;){
+    if(argc >= 3 && strcmp(argv[1], "-l") == 0)
+      logsize = atoi(argv[2]);
+    else if(argc >= 3 && strcmp(argv[1], "-s") == 0)
+      nswap = atoi(argv[2]);
+    else
+      break;
+    argc -= 2;
+    argv += 2;
+  }
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l regionblocks] [-s swappages] fs.img files...\n");
+    exit(1);
+  }
+  if(nswap < 0 || nswap > NSWAP){
+    fprintf(stderr, "mkfs: at most %d swap pages\n", NSWAP);
+    exit(1);
+  }
+  if(logsize <= MAXOPBLOCKS || logsize > LOGREGMAX){
+    fprintf(stderr, "mkfs: log regions of %d to %d blocks\n",
+            MAXOPBLOCKS+1, LOGREGMAX);
     exit(1);
   }
+  nlog = 2*logsize;
 
   assert((BSIZE % sizeof(struct dinode)) == 0);
   assert((BSIZE % sizeof(struct dirent)) == 0);
@@ -101,6 +124,8 @@ main(int argc, char *argv[])
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
+  sb.swapstart = xint(FSSIZE);
+  sb.nswap = xint(nswap);
 
   printf("nmeta %d (boot, super, log blocks %u inode blocks %u, bitmap blocks %u) blocks %d total %d\n",
          nmeta, nlog, ninodeblocks, nbitmap, nblocks, FSSIZE);
@@ -109,6 +134,9 @@ main(int argc, char *argv[])
 
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
+  // The swap area needs no contents, just room.
+  if(nswap > 0)
+    wsect(FSSIZE + nswap*SWAPPGBLKS - 1, zeroes);
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
@@ -10,6 +10,7 @@
 #define CR0_PG          0x80000000      // Paging
 
 #define CR4_PSE         0x00000010      // Page size extension
+#define CR4_PGE         0x00000080      // Page global enable
 
 // various segment selectors.
 #define SEG_KCODE 1  // kernel code
@@ -83,23 +84,36 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define SUPERPGSIZE     (PGSIZE*NPTENTRIES) // bytes mapped by a PTE_PS entry
+#define SUPERPGORDER    10      // SUPERPGSIZE is PGSIZE << SUPERPGORDER
 
 #define PTXSHIFT        12      // offset of PTX in a linear address
 #define PDXSHIFT        22      // offset of PDX in a linear address
 
 #define PGROUNDUP(sz)  (((sz)+PGSIZE-1) & ~(PGSIZE-1))
 #define PGROUNDDOWN(a) (((a)) & ~(PGSIZE-1))
+#define SUPERPGROUNDUP(sz)  (((sz)+SUPERPGSIZE-1) & ~(SUPERPGSIZE-1))
 
 // Page table/directory entry flags.
 #define PTE_P           0x001   // Present
 #define PTE_W           0x002   // Writeable
 #define PTE_U           0x004   // User
+#define PTE_A           0x020   // Accessed
+#define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
+#define PTE_G           0x100   // Global: survives %cr3 loads if CR4_PGE
+#define PTE_SWAP        0x200   // Not present: PTE_ADDR holds a swap slot
+#define PTE_ZERO        0x400   // Maps zeropage; a write gets a private page
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
 #define PTE_FLAGS(pte)  ((uint)(pte) &  0xFFF)
 
+// Page fault error code bits, pushed by the processor for T_PGFLT.
+#define FEC_PR          0x1     // Protection violation (page was present)
+#define FEC_WR          0x2     // Fault was caused by a write
+#define FEC_U           0x4     // Fault occurred in user mode
+
 #ifndef __ASSEMBLER__
 typedef uint pte_t;
 
@@ -0,0 +1,254 @@
+// Page cache for demand-paged file contents.
+//
+// The page cache holds whole pages of file data, keyed by
+// (device, inode number, file offset, length), so that every
+// process running the same program maps the same physical
+// pages for its text and initialized data, even across exec.
+// pagefault() maps cached pages read-only; a process that
+// writes one gets a private copy (see vm.c). Pages of
+// MAP_SHARED mappings are mapped writable instead, and
+// are marked shared here. A shared page holds as much of the
+// file as there is, whatever the mapping covers, so that it
+// stays the file's page as writes extend the file.
+//
+// Interface:
+// * pcget(ip, off, n, shared) returns a page holding n bytes
+//     of ip starting at off, followed by zeros, with a
+//     reference for the caller (drop it with kfree).
+// * pcwrite(ip, src, off, n) is called by writei(): it copies
+//     the new data into shared pages, so that mappers see it,
+//     and forgets the other pages of ip.
+// * pcread(ip, dst, off, n) is called by readi() while ip is
+//     mapped shared and writable: it copies from a shared page,
+//     which may hold stores not yet written back to the file.
+// * pcinval(ip) forgets all pages of ip; itrunc() calls it.
+//
+// The cache keeps one kalloc() reference to each page.
+// Replacement is least recently used; evicting a page only
+// drops the cache's reference, so processes that still map
+// it are unaffected. Shared pages that are still mapped are
+// not evicted, since a new mapper must get the same page.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+struct pcpage {
+  uint dev;
+  uint inum;       // 0 if this slot is free
+  uint off;        // file offset of first byte
+  uint n;          // bytes from the file; the rest is zero
+  int shared;      // mapped writable by some MAP_SHARED mapping
+  char *data;
+  uint lastuse;    // pcache.clock at last lookup
+};
+
+struct {
+  struct spinlock lock;
+  struct pcpage page[NPCACHE];
+  uint clock;
+  uint npages;
+  uint hits;
+  uint misses;
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Drop the cache's reference to p's page and free the slot.
+// Caller must hold pcache.lock.
+static void
+pcdrop(struct pcpage *p)
+{
+  kfree(p->data);
+  p->data = 0;
+  p->inum = 0;
+  pcache.npages--;
+}
+
+// Return a page containing bytes [off, off+n) of ip followed
+// by zeros, with a new reference for the caller. If shared,
+// the caller will map the page writable for MAP_SHARED.
+// Returns 0 if out of memory or the file is too short.
+// Caller must not hold ip->lock.
+char*
+pcget(struct inode *ip, uint off, uint n, int shared)
+{
+  struct pcpage *p, *victim;
+  char *mem;
+
+  if(n > PGSIZE)
+    panic("pcget");
+
+  // Holding ip->lock across lookup and insertion keeps two
+  // faults on the same page from both reading it in, and
+  // keeps writei() from changing the file in between.
+  ilock(ip);
+  if(shared)
+    n = ip->size <= off ? 0 : ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+  acquire(&pcache.lock);
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++){
+    if(p->inum == ip->inum && p->dev == ip->dev &&
+       p->off == off && p->n == n){
+      p->lastuse = ++pcache.clock;
+      p->shared |= shared;
+      pcache.hits++;
+      mem = p->data;
+      kincref(mem);
+      release(&pcache.lock);
+      iunlock(ip);
+      return mem;
+    }
+  }
+  pcache.misses++;
+  release(&pcache.lock);
+
+  if((mem = kalloc()) == 0){
+    iunlock(ip);
+    return 0;
+  }
+  memset(mem, 0, PGSIZE);
+  if(readi(ip, mem, off, n) != n){
+    iunlock(ip);
+    kfree(mem);
+    return 0;
+  }
+
+  acquire(&pcache.lock);
+  victim = 0;
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++){
+    if(p->inum == 0){
+      victim = p;
+      break;
+    }
+    if(p->shared && krefcount(p->data) > 1)
+      continue;
+    if(victim == 0 || p->lastuse < victim->lastuse)
+      victim = p;
+  }
+  if(victim == 0){
+    // Every page is mapped shared: hand out an uncached page.
+    release(&pcache.lock);
+    iunlock(ip);
+    return mem;
+  }
+  if(victim->inum != 0)
+    pcdrop(victim);
+  victim->dev = ip->dev;
+  victim->inum = ip->inum;
+  victim->off = off;
+  victim->n = n;
+  victim->shared = shared;
+  victim->data = mem;
+  victim->lastuse = ++pcache.clock;
+  pcache.npages++;
+  kincref(mem);
+  release(&pcache.lock);
+  iunlock(ip);
+  return mem;
+}
+
+// Bytes [off, off+n) of ip are being overwritten with src.
+// Update shared pages in place, extending them if the write
+// extends the file, and forget the others, so that running
+// programs keep their old text but later faults see the new
+// data. Returns -1 if src could not be read. Caller must hold
+// ip->lock.
+int
+pcwrite(struct inode *ip, char *src, uint off, uint n)
+{
+  struct pcpage *p;
+  uint lo, hi;
+  int r;
+
+  r = 0;
+  acquire(&pcache.lock);
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++){
+    if(p->inum != ip->inum || p->dev != ip->dev)
+      continue;
+    if(!p->shared){
+      pcdrop(p);
+      continue;
+    }
+    lo = off > p->off ? off : p->off;
+    hi = off + n < p->off + PGSIZE ? off + n : p->off + PGSIZE;
+    if(lo < hi){
+      if(ucopy(p->data + (lo - p->off), src + (lo - off), hi - lo) < 0){
+        r = -1;
+        continue;
+      }
+      if(hi - p->off > p->n)
+        p->n = hi - p->off;
+    }
+  }
+  release(&pcache.lock);
+  return r;
+}
+
+// Copy up to n bytes of ip from off to dst out of the shared
+// page holding off, if there is one. Returns the number of
+// bytes copied, 0 if there is none, or -1 if dst could not be
+// written. Caller must hold ip->lock, so the page stays the
+// file's while the copy is made without pcache.lock: dst may be
+// user memory.
+int
+pcread(struct inode *ip, char *dst, uint off, uint n)
+{
+  struct pcpage *p;
+  char *mem;
+  uint m;
+  int r;
+
+  acquire(&pcache.lock);
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++)
+    if(p->inum == ip->inum && p->dev == ip->dev && p->shared &&
+       p->off <= off && off < p->off + p->n)
+      break;
+  if(p == &pcache.page[NPCACHE]){
+    release(&pcache.lock);
+    return 0;
+  }
+  mem = p->data;
+  kincref(mem);
+  m = p->off + p->n - off;
+  if(m > n)
+    m = n;
+  off -= p->off;
+  release(&pcache.lock);
+  r = ucopy(dst, mem + off, m) < 0 ? -1 : m;
+  kfree(mem);
+  return r;
+}
+
+// Forget every cached page of ip, because its contents
+// are about to change. Caller must hold ip->lock.
+void
+pcinval(struct inode *ip)
+{
+  struct pcpage *p;
+
+  acquire(&pcache.lock);
+  for(p = pcache.page; p < &pcache.page[NPCACHE]; p++)
+    if(p->inum == ip->inum && p->dev == ip->dev)
+      pcdrop(p);
+  release(&pcache.lock);
+}
+
+// Report the number of cached pages and lookup statistics.
+void
+pcstat(uint *npages, uint *hits, uint *misses)
+{
+  acquire(&pcache.lock);
+  *npages = pcache.npages;
+  *hits = pcache.hits;
+  *misses = pcache.misses;
+  release(&pcache.lock);
+}
@@ -7,8 +7,43 @@
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
+#define MAXPATH     128  // max file path name
+#define MAXUSTACK    64  // max pages of user stack, grown on demand
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#ifndef LOGSIZE
+#define LOGSIZE     256  // blocks in each of the two log regions, set by mkfs (make LOGSIZE=n)
+#endif
+#ifndef LOGDEFER
+#define LOGDEFER      1  // write committed blocks home only when a log region fills (make LOGDEFER=0)
+#endif
+#define LOGDELAY      2  // ticks a transaction may wait for more system calls
+#ifndef NBUF
+#define NBUF         (MAXOPBLOCKS*3)  // initial size of disk block cache (make NBUF=n)
+#endif
+#define NBHASH      251  // buffer cache hash buckets
+#ifndef RAWINDOW
+#define RAWINDOW      8  // blocks read ahead of sequential reads (make RAWINDOW=n)
+#endif
+#define RIBATCH       8  // blocks readi() has at the disk at once
+#ifndef IDEDMA
+#define IDEDMA        1  // disk DMA, if the IDE controller can (make IDEDMA=0)
+#endif
+#ifndef IDEMERGE
+#define IDEMERGE     16  // max blocks per disk command, a power of 2 (make IDEMERGE=n)
+#endif
+#define FSSIZE       3000  // size of file system in blocks
+#define NVMA        256  // maximum number of demand-paged regions
+#define NPCACHE     512  // pages of file data in the page cache
+#define NORDER       11  // block sizes of the page allocator: 2^0..2^10 pages
+#define NSHM         16  // shared-memory segments
+#define SHMMAXPG     64  // pages in a shared-memory segment
+#define SHMNAME      16  // bytes in a segment name, including nul
+#define NFUTEXHASH   31  // futex wait queue hash buckets
+#define NSWAP      1024  // pages of swap space after the file system
+#ifndef MEMLIMIT
+#define MEMLIMIT      0  // allow memlimit(), which any process could use to starve all (make MEMLIMIT=1)
+#endif
+#ifndef DROPCACHE
+#define DROPCACHE     0  // allow dropcache(), which any process could use to slow all (make DROPCACHE=1)
+#endif
 
@@ -0,0 +1,71 @@
+// PCI configuration space, by configuration mechanism #1:
+// write the address of a register to port 0xcf8, then read or
+// write its value at port 0xcfc. Only bus 0 is scanned, which
+// is where QEMU puts its devices.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_ADDR 0xcf8
+#define PCI_DATA 0xcfc
+
+#define NPCIDEV  32  // devices on a bus
+#define NPCIFUNC 8   // functions of a device
+
+static uint
+pciaddr(struct pcidev *d, uint off)
+{
+  return 0x80000000 | d->bus<<16 | d->dev<<11 | d->func<<8 | (off & 0xfc);
+}
+
+uint
+pciread(struct pcidev *d, uint off)
+{
+  outl(PCI_ADDR, pciaddr(d, off));
+  return inl(PCI_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, uint off, uint v)
+{
+  outl(PCI_ADDR, pciaddr(d, off));
+  outl(PCI_DATA, v);
+}
+
+// Find the first function on bus 0 with the given vendor and
+// device ids and base class and subclass, any of which may be
+// PCI_ANY, and fill in *d. Returns 0, or -1 if there is none.
+int
+pcifind(uint vendor, uint device, uint class, uint subclass, struct pcidev *d)
+{
+  uint id, cl, bar;
+  int i;
+
+  d->bus = 0;
+  for(d->dev = 0; d->dev < NPCIDEV; d->dev++){
+    for(d->func = 0; d->func < NPCIFUNC; d->func++){
+      id = pciread(d, PCI_ID);
+      if((id & 0xffff) == 0xffff)
+        continue;
+      cl = pciread(d, PCI_CLASS);
+      d->vendor = id & 0xffff;
+      d->device = id >> 16;
+      d->class = cl >> 24;
+      d->subclass = (cl >> 16) & 0xff;
+      if((vendor != PCI_ANY && d->vendor != vendor) ||
+         (device != PCI_ANY && d->device != device) ||
+         (class != PCI_ANY && d->class != class) ||
+         (subclass != PCI_ANY && d->subclass != subclass))
+        continue;
+      for(i = 0; i < 6; i++){
+        bar = pciread(d, PCI_BAR0 + 4*i);
+        d->bar[i] = bar & 1 ? bar & ~0x3 : bar & ~0xf;
+      }
+      d->irq = pciread(d, PCI_INTR) & 0xff;
+      return 0;
+    }
+  }
+  return -1;
+}
@@ -0,0 +1,26 @@
+// PCI configuration space.
+
+#define PCI_ANY       0xffffffff  // pcifind(): match any value
+
+#define PCI_ID        0x00  // device id << 16 | vendor id
+#define PCI_CMD       0x04  // command register (low 16 bits)
+#define PCI_CLASS     0x08  // class << 24 | subclass << 16 | ...
+#define PCI_BAR0      0x10  // base address registers, 6 of them
+#define PCI_INTR      0x3c  // interrupt line (low 8 bits)
+
+#define PCI_CMD_IO     0x1  // respond to I/O space accesses
+#define PCI_CMD_MEM    0x2  // respond to memory space accesses
+#define PCI_CMD_MASTER 0x4  // may master the bus (DMA)
+
+// A PCI function, as found by pcifind().
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  uint vendor;
+  uint device;
+  uint class;       // base class
+  uint subclass;
+  uint bar[6];      // base addresses, flag bits cleared
+  uint irq;         // interrupt line set up by the BIOS
+};
@@ -75,13 +75,28 @@ pipeclose(struct pipe *p, int writable)
 }
 
 //PAGEBREAK: 40
+// Copy as many bytes as fit in the contiguous run of the ring
+// buffer starting at index i, at most n and at most avail.
+static int
+piperun(uint i, int n, int avail)
+{
+  int m;
+
+  m = PIPESIZE - i % PIPESIZE;
+  if(m > avail)
+    m = avail;
+  if(m > n)
+    m = n;
+  return m;
+}
+
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
+  for(i = 0; i < n; i += m){
     while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
       if(p->readopen == 0 || myproc()->killed){
         release(&p->lock);
@@ -90,17 +105,20 @@ pipewrite(struct pipe *p, char *addr, int n)
       wakeup(&p->nread);
       sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    m = piperun(p->nwrite, n - i, p->nread + PIPESIZE - p->nwrite);
+    if(ucopy(&p->data[p->nwrite % PIPESIZE], addr + i, m) < 0)
+      break;
+    p->nwrite += m;
   }
   wakeup(&p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
-  return n;
+  return i < n ? -1 : n;
 }
 
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
   while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
@@ -110,10 +128,13 @@ piperead(struct pipe *p, char *addr, int n)
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  for(i = 0; i < n && p->nread != p->nwrite; i += m){  //DOC: piperead-copy
+    m = piperun(p->nread, n - i, p->nwrite - p->nread);
+    if(ucopy(addr + i, &p->data[p->nread % PIPESIZE], m) < 0){
+      i = -1;
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    }
+    p->nread += m;
   }
   wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
 
 struct {
   struct spinlock lock;
@@ -105,6 +106,12 @@ found:
   p->wait_time = 0;
   p->creation_time = ticks;  // Track process creation time
   p->cs = 0;  // Initialize context switch count
+  p->superpages = 0;
+  p->exiting = 0;
+  p->ustack = 0;
+  p->insyscall = 0;
+  p->rsslimit = 0;
+  p->logseq = 0;
   // Set up new context to start executing at forkret,
   // which returns to trapret.
   sp -= 4;
@@ -156,25 +163,153 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// A kernel process starts here, from scheduler(), with its
+// function and argument above it on the stack; see kproc().
+static void
+kprocstart(void (*fn)(void*), void *arg)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+  fn(arg);
+  panic("kproc returned");
+}
+
+// Start a process that runs fn(arg) in the kernel, with no
+// user memory, and never returns to user space. Must be called
+// from a process, after userinit(). Returns its pid.
+int
+kproc(char *name, void (*fn)(void*), void *arg)
+{
+  struct proc *p;
+  uint *sp;
+
+  if((p = allocproc()) == 0)
+    panic("kproc");
+  if((p->pgdir = setupkvm()) == 0)
+    panic("kproc: out of memory");
+  p->sz = 0;
+  p->parent = initproc;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  // Enter kprocstart() rather than forkret(). Its return
+  // address takes the place of trapret's, and its arguments
+  // the start of the unused trap frame.
+  p->context->eip = (uint)kprocstart;
+  sp = (uint*)(p->context + 1);
+  sp[0] = 0;
+  sp[1] = (uint)fn;
+  sp[2] = (uint)arg;
+
+  acquire(&ptable.lock);
+  p->state = RUNNABLE;
+  release(&ptable.lock);
+  return p->pid;
+}
+
+// Would growing p by n bytes take it past its rsslimit? Pages
+// still mapped to the zero page count as resident, since they
+// may be written at any time without another growproc().
+// Caller must hold ptable.lock.
+static int
+overlimit(struct proc *p, int n)
+{
+  struct procmem pm;
+
+  uvmstat(p->pgdir, &pm);
+  return pm.rss + pm.zero + PGROUNDUP(n) / PGSIZE > p->rsslimit;
+}
+
 // Grow current process's memory by n bytes.
-// Return 0 on success, -1 on failure.
+// Return the old size on success, -1 on failure: out of memory,
+// or past the process's rsslimit.
 int
 growproc(int n)
 {
-  uint sz;
+  uint sz, oldsz;
   struct proc *curproc = myproc();
-
-  sz = curproc->sz;
-  if(n > 0){
-    if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+  struct proc *p;
+  int over;
+
+  // Threads share the address space and its size, so only one
+  // may change it at a time, and not while another faults.
+  lockuvm(curproc->pgdir);
+  sz = oldsz = curproc->sz;
+  if(n > 0 && vmammapped(curproc->pgdir, sz, sz + n))
+    goto bad;
+  acquire(&ptable.lock);
+  over = n > 0 && curproc->rsslimit && overlimit(curproc, n);
+  release(&ptable.lock);
+  if(over)
+    goto bad;
+  if(n > 0 && curproc->superpages){
+    if((sz = allocsuvm(curproc->pgdir, sz, sz + n)) == 0)
+      goto bad;
+  } else if(n > 0){
+    if((sz = zerouvm(curproc->pgdir, sz, sz + n)) == 0)
+      goto bad;
   } else if(n < 0){
     if((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
-      return -1;
+      goto bad;
   }
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p->pgdir == curproc->pgdir)
+      p->sz = sz;
+  release(&ptable.lock);
+  unlockuvm(curproc->pgdir);
+  switchuvm(curproc);
+  return oldsz;
+
+bad:
+  unlockuvm(curproc->pgdir);
+  return -1;
+}
+
+// Count the processes other than self that use pgdir: all of
+// them if all, else only those that have not begun to exit.
+// Caller must hold ptable.lock.
+static int
+vmusers(pde_t *pgdir, struct proc *self, int all)
+{
+  struct proc *p;
+  int n;
+
+  n = 0;
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if(p != self && p->state != UNUSED && p->pgdir == pgdir &&
+       (all || !p->exiting))
+      n++;
+  return n;
+}
+
+// Give the current process the new page table pgdir, of size
+// sz, for exec(), and let go of the old one. Other threads may
+// still be using it: the last one out clears its regions, and
+// the last one reaped frees it.
+void
+replacevm(pde_t *pgdir, uint sz)
+{
+  struct proc *curproc = myproc();
+  pde_t *oldpgdir;
+  int last, gone;
+
+  acquire(&ptable.lock);
+  oldpgdir = curproc->pgdir;
+  curproc->pgdir = pgdir;
   curproc->sz = sz;
+  last = vmusers(oldpgdir, curproc, 0) == 0;
+  gone = vmusers(oldpgdir, curproc, 1) == 0;
+  release(&ptable.lock);
   switchuvm(curproc);
-  return 0;
+
+  if(last){
+    vmawriteback(oldpgdir, 0, KERNBASE);
+    begin_op();
+    vmaclear(oldpgdir);
+    end_op();
+  }
+  if(gone)
+    freevm(oldpgdir);
 }
 
 // Create a new process copying p as the parent.
@@ -183,7 +318,7 @@ growproc(int n)
 int
 fork(void)
 {
-  int i, pid;
+  int i, pid, err;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -192,8 +327,24 @@ fork(void)
     return -1;
   }
 
-  // Copy process state from proc.
+  // Copy process state from proc, with other threads' faults
+  // held off.
+  lockuvm(curproc->pgdir);
   if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
+    unlockuvm(curproc->pgdir);
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+  err = vmacopy(curproc->pgdir, np->pgdir);
+  unlockuvm(curproc->pgdir);
+  if(err < 0){
+    begin_op();
+    vmaclear(np->pgdir);
+    end_op();
+    freevm(np->pgdir);
+    np->pgdir = 0;
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
@@ -201,6 +352,8 @@ fork(void)
   }
   np->sz = curproc->sz;
   np->parent = curproc;
+  np->superpages = curproc->superpages;
+  np->rsslimit = curproc->rsslimit;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -230,6 +383,62 @@ fork(void)
   return pid;
 }
 
+// Create a thread: a process that shares the current process's
+// address space and starts in fn(arg) on the user stack
+// [stack, stack+PGSIZE), which the caller has checked. fn must
+// call exit() rather than return.
+int
+clone(void (*fn)(void*), void *arg, void *stack)
+{
+  int i, pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+  uint sp, ustack[2];
+
+  if((np = allocproc()) == 0)
+    return -1;
+
+  ustack[0] = 0xffffffff;  // fake return PC
+  ustack[1] = (uint)arg;
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  if(ucopy((char*)sp, ustack, sizeof(ustack)) < 0){
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
+  lockuvm(curproc->pgdir);  // growproc() may be changing sz
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  unlockuvm(curproc->pgdir);
+  np->parent = curproc;
+  np->superpages = curproc->superpages;
+  np->rsslimit = curproc->rsslimit;
+  np->ustack = (uint)stack;
+  *np->tf = *curproc->tf;
+  np->tf->esp = sp;
+  np->tf->eip = (uint)fn;
+
+  for(i = 0; i < NOFILE; i++)
+    if(curproc->ofile[i])
+      np->ofile[i] = filedup(curproc->ofile[i]);
+  np->cwd = idup(curproc->cwd);
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+  np->state = RUNNABLE;
+  np->exec_time = -1;
+  np->start_later = 0;
+  np->first_scheduled = 0;
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -238,7 +447,7 @@ exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
+  int fd, last;
   curproc->end_time = ticks; // Record process completion time
   // cprintf("End time: %d", curproc->end_time);
   // cprintf("Start time: %d", curproc->creation_time);
@@ -263,8 +472,19 @@ exit(void)
     }
   }
 
+  // The last thread out writes back and clears the regions of
+  // the address space; whoever reaps the last one frees it.
+  acquire(&ptable.lock);
+  curproc->exiting = 1;
+  last = vmusers(curproc->pgdir, curproc, 0) == 0;
+  release(&ptable.lock);
+
+  if(last)
+    vmawriteback(curproc->pgdir, 0, KERNBASE);
   begin_op();
   iput(curproc->cwd);
+  if(last)
+    vmaclear(curproc->pgdir);
   end_op();
   curproc->cwd = 0;
 
@@ -291,8 +511,26 @@ exit(void)
   panic("zombie exit");
 }
 
+// Free a zombie child p, and its page table too unless other
+// threads still use it. Caller must hold ptable.lock.
+static void
+reap(struct proc *p)
+{
+  kfree(p->kstack);
+  p->kstack = 0;
+  if(vmusers(p->pgdir, p, 1) == 0)
+    freevm(p->pgdir);
+  p->pgdir = 0;
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
+}
+
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Threads are not children here; see join().
 int
 wait(void)
 {
@@ -305,20 +543,13 @@ wait(void)
     // Scan through table looking for exited children.
     havekids = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
-      if(p->parent != curproc)
+      if(p->parent != curproc || p->pgdir == curproc->pgdir)
         continue;
       havekids = 1;
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        reap(p);
         release(&ptable.lock);
         return pid;
       }
@@ -335,6 +566,43 @@ wait(void)
   }
 }
 
+// Wait for a thread made by clone() to exit and return its pid,
+// setting *stack to the stack it was given so the caller can
+// free it. Return -1 if this process has no threads.
+int
+join(void **stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  uint ustack;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  for(;;){
+    havekids = 0;
+    for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+      if(p->parent != curproc || p->pgdir != curproc->pgdir)
+        continue;
+      havekids = 1;
+      if(p->state == ZOMBIE){
+        pid = p->pid;
+        ustack = p->ustack;
+        reap(p);
+        release(&ptable.lock);
+        *stack = (void*)ustack;
+        return pid;
+      }
+    }
+
+    if(!havekids || curproc->killed){
+      release(&ptable.lock);
+      return -1;
+    }
+
+    sleep(curproc, &ptable.lock);  //DOC: wait-sleep
+  }
+}
+
 // int wait(void) {
 //   struct proc *p;
 //   int havekids, pid;
@@ -488,6 +756,7 @@ scheduler(void){
   struct proc *p;
   struct proc *p1;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
 
   for(;;){
@@ -496,8 +765,15 @@ scheduler(void){
 
     
     // Loop over process table looking for process to run.
+    // Keep running processes without releasing ptable.lock, so
+    // that %cr3 can be left holding the last process's page
+    // table: no one can free it until the lock is released.
+    // Running the same process (or a thread sharing its page
+    // table) again then needs no TLB flush.
     acquire(&ptable.lock);
     struct proc *highP =  0;
+    for(ran = 1; ran; ){
+    ran = 0;
     for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
       if(p->state != RUNNABLE)
         continue;
@@ -527,20 +803,26 @@ scheduler(void){
       // p = highP;
       p->wait_time = 0;
       c->proc = p;
-      switchuvm(p);
+      if(c->pgdir == p->pgdir)
+        switchtss(p);
+      else
+        switchuvm(p);
       p->state = RUNNING;
       // int start=ticks;
       swtch(&(c->scheduler), p->context);
       // int end=ticks;
       // p->cpu_ticks+=(end-start);
-      switchkvm();
 
       c->proc = 0;
+      ran = 1;
       break;
     }
+    }
     // highP->cs++;  // Count context switches
     // highP->cpu_ticks++;  // Increment CPU usage time
     // highP->wait_time = 0;
+    switchkvm();
+    c->pgdir = 0;
     release(&ptable.lock);
 
   }
@@ -742,7 +1024,7 @@ scheduler_start(void)
 }
 
 int custom_fork(int start_later, int exec_time) {
-  int i, pid;
+  int i, pid, err;
   struct proc *np;
   struct proc *curproc = myproc();
 
@@ -751,8 +1033,24 @@ int custom_fork(int start_later, int exec_time) {
       return -1;
   }
 
-  // Copy process state from parent.
+  // Copy process state from parent, with other threads' faults
+  // held off.
+  lockuvm(curproc->pgdir);
   if ((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0) {
+      unlockuvm(curproc->pgdir);
+      kfree(np->kstack);
+      np->kstack = 0;
+      np->state = UNUSED;
+      return -1;
+  }
+  err = vmacopy(curproc->pgdir, np->pgdir);
+  unlockuvm(curproc->pgdir);
+  if (err < 0) {
+      begin_op();
+      vmaclear(np->pgdir);
+      end_op();
+      freevm(np->pgdir);
+      np->pgdir = 0;
       kfree(np->kstack);
       np->kstack = 0;
       np->state = UNUSED;
@@ -760,6 +1058,8 @@ int custom_fork(int start_later, int exec_time) {
   }
   np->sz = curproc->sz;
   np->parent = curproc;
+  np->superpages = curproc->superpages;
+  np->rsslimit = curproc->rsslimit;
   *np->tf = *curproc->tf;
 
   // Clear %eax so that fork returns 0 in the child.
@@ -829,6 +1129,117 @@ yield(void)
   release(&ptable.lock);
 }
 
+// Can p's pages be swapped out? Not if p or another thread
+// sharing its memory is in a system call or running: a CPU
+// running one may have the old PTE in its TLB (see swap.c).
+// Holding ptable.lock keeps them from starting to run, and the
+// switch to a page table flushes the TLB.
+// Caller must hold ptable.lock.
+static int
+swappable(struct proc *p)
+{
+  struct proc *q;
+
+  if(p->state != SLEEPING && p->state != RUNNABLE)
+    return 0;
+  for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+    if(q->state != UNUSED && q->pgdir == p->pgdir &&
+       (q->insyscall || q->state == RUNNING))
+      return 0;
+  return 1;
+}
+
+// Choose a page to swap out to slot. A clock hand sweeps the
+// page tables of the swappable processes in turn. Returns the
+// page, whose PTE now names slot, or 0 if none turned up in
+// two sweeps.
+char*
+swapvictim(uint slot)
+{
+  static int hand;
+  static uint handva;
+  struct proc *p;
+  char *mem;
+  int n;
+
+  acquire(&ptable.lock);
+  for(n = 0; n < 2*NPROC; n++){
+    p = &ptable.proc[hand];
+    if(swappable(p) &&
+       (mem = uvmevict(p->pgdir, p->sz, &handva, slot)) != 0){
+      release(&ptable.lock);
+      return mem;
+    }
+    hand = (hand + 1) % NPROC;
+    handva = 0;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Fill in up to n entries of pm with the memory use of each
+// process, for the procmem() system call. Returns the number
+// of entries filled in.
+int
+procmem(struct procmem *pm, int n)
+{
+  struct proc *p;
+  int i;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++){
+    // A fork child's pgdir may be half built, and freed
+    // without the lock, until it leaves EMBRYO.
+    if(p->state == UNUSED || p->state == EMBRYO)
+      continue;
+    memset(&pm[i], 0, sizeof(pm[i]));
+    pm[i].pid = p->pid;
+    safestrcpy(pm[i].name, p->name, sizeof(pm[i].name));
+    pm[i].kstack = p->kstack ? KSTACKSIZE / PGSIZE : 0;
+    pm[i].rsslimit = p->rsslimit;
+    // A thread's pages are counted with the process that
+    // created it.
+    if(p->pgdir && !(p->parent && p->parent->pgdir == p->pgdir)){
+      pm[i].sz = p->sz;
+      uvmstat(p->pgdir, &pm[i]);
+    }
+    i++;
+  }
+  release(&ptable.lock);
+  return i;
+}
+
+// Limit process pid (or the caller, if pid is 0) and the threads
+// sharing its memory to npages resident pages, checked when they
+// grow; 0 removes the limit. A negative npages leaves the limit
+// as it is. Returns the old limit, or -1 if there is no such pid.
+int
+rsslimit(int pid, int npages)
+{
+  struct proc *p, *q;
+  int old;
+
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->state == UNUSED || p->state == ZOMBIE)
+      continue;
+    if(pid == 0 ? p == myproc() : p->pid == pid)
+      break;
+  }
+  if(p == &ptable.proc[NPROC]){
+    release(&ptable.lock);
+    return -1;
+  }
+  old = p->rsslimit;
+  if(npages >= 0)
+    for(q = ptable.proc; q < &ptable.proc[NPROC]; q++)
+      if(q->state != UNUSED && q->pgdir == p->pgdir)
+        q->rsslimit = npages;
+  release(&ptable.lock);
+  return old;
+}
+
 // A fork child's very first scheduling by scheduler()
 // will swtch here.  "Return" to user space.
 void
@@ -845,6 +1256,7 @@ forkret(void)
     first = 0;
     iinit(ROOTDEV);
     initlog(ROOTDEV);
+    swapinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -8,6 +8,8 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  pde_t *pgdir;                // User page table in %cr3, or null
+  volatile uint tlbflushes;    // TLB shootdowns taken (see uvmflush)
 };
 
 
@@ -68,10 +70,21 @@ struct proc {
   uint end_time;    // Time when process ends
   uint creation_time;
   uint switches;
+  int superpages;              // If non-zero, grow heap with 4-Mbyte pages
+  int exiting;                 // Has begun to exit (see vmusers)
+  uint ustack;                 // User stack given to clone(), for join()
+  int insyscall;               // In a system call: memory not swappable
+  uint rsslimit;               // Max resident+zero pages for growproc, 0 if none
+  uint logseq;                 // Log transaction holding our changes (log.c)
 };
 
+// Threads made by clone() are processes that share their parent's
+// pgdir (and so sz and mmap regions), though each has its own
+// ofile[] and cwd references.
+//
 // Process memory is laid out contiguously, low addresses first:
 //   text
 //   original data and bss
-//   fixed-size stack
+//   unmapped guard page
+//   stack, grown on demand up to MAXUSTACK pages
 //   expandable heap
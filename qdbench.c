@@ -0,0 +1,96 @@
+// Disk queue depth against read throughput.
+//
+//   qdbench [runs]
+//
+// Reads a file as large as the file system allows runs times
+// (default 5), each time from an empty buffer cache, keeping
+// more and more blocks at the disk at once: first with
+// read-ahead off and reads of 1 to RIBATCH blocks, each of
+// which readi() starts together, and then with single-block
+// reads and read-ahead windows of 1 to 32 blocks. Run it under
+// make qemu and make qemu-virtio to compare the IDE disk with a
+// virtio-blk one, which takes every request at once. Needs a
+// kernel built with make DROPCACHE=1.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "param.h"
+#include "fs.h"
+
+#define FILENAME "qdbench.tmp"
+
+char buf[RIBATCH*BSIZE];
+
+// Returns the ticks taken to read the file runs times with
+// reads of n bytes.
+int
+run(int runs, int n)
+{
+  int i, fd, t, t0, total, r;
+
+  t = 0;
+  for(i = 0; i < runs; i++){
+    if(dropcache() < 0){
+      printf(2, "qdbench: dropcache failed; build with DROPCACHE=1\n");
+      exit();
+    }
+    t0 = uptime();
+    if((fd = open(FILENAME, O_RDONLY)) < 0){
+      printf(2, "qdbench: cannot open %s\n", FILENAME);
+      exit();
+    }
+    total = 0;
+    while((r = read(fd, buf, n)) > 0)
+      total += r;
+    close(fd);
+    t += uptime() - t0;
+    if(total != MAXFILE*BSIZE){
+      printf(2, "qdbench: read %d bytes\n", total);
+      exit();
+    }
+  }
+  return t;
+}
+
+void
+report(char *what, int depth, int runs, int ticks)
+{
+  printf(1, "%s %d\t%d ticks\t", what, depth, ticks);
+  if(ticks > 0)
+    printf(1, "%d Kbytes/s\n", runs*MAXFILE*BSIZE/1024*100/ticks);
+  else
+    printf(1, "-\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, runs, window;
+
+  runs = argc >= 2 ? atoi(argv[1]) : 5;
+  if((fd = open(FILENAME, O_CREATE|O_RDWR)) < 0){
+    printf(2, "qdbench: cannot create %s\n", FILENAME);
+    exit();
+  }
+  memset(buf, 'q', BSIZE);
+  for(i = 0; i < MAXFILE; i++)
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(2, "qdbench: write failed\n");
+      exit();
+    }
+  close(fd);
+
+  printf(1, "qdbench: %d reads of %d Kbytes\n", runs, MAXFILE*BSIZE/1024);
+  window = readahead(0);
+  for(i = 1; i <= RIBATCH; i *= 2)
+    report("read size", i, runs, run(runs, i*BSIZE));
+  for(i = 1; i <= 32; i *= 2){
+    readahead(i);
+    report("read-ahead", i, runs, run(runs, BSIZE));
+  }
+  readahead(window);
+  unlink(FILENAME);
+  exit();
+}
@@ -0,0 +1,93 @@
+// Sequential read-ahead.
+//
+//   rabench [runs]
+//
+// Times cat and wc over a file as large as the file system
+// allows, starting each run with an empty buffer cache, first
+// with read-ahead off and then with the kernel's window.
+// Needs a kernel built with make DROPCACHE=1.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "fcntl.h"
+#include "fs.h"
+
+#define FILENAME "rabench.tmp"
+
+char buf[BSIZE];
+
+// Run prog on the file with its output into a pipe, which is
+// read and thrown away. Returns the ticks taken.
+int
+run(char *prog)
+{
+  char *argv[3];
+  int fds[2], t0;
+
+  argv[0] = prog;
+  argv[1] = FILENAME;
+  argv[2] = 0;
+  if(pipe(fds) < 0){
+    printf(2, "rabench: pipe failed\n");
+    exit();
+  }
+  if(dropcache() < 0){
+    printf(2, "rabench: dropcache failed; build with DROPCACHE=1\n");
+    exit();
+  }
+  t0 = uptime();
+  if(fork() == 0){
+    close(1);
+    dup(fds[1]);
+    close(fds[0]);
+    close(fds[1]);
+    exec(prog, argv);
+    printf(2, "rabench: exec %s failed\n", prog);
+    exit();
+  }
+  close(fds[1]);
+  while(read(fds[0], buf, sizeof(buf)) > 0)
+    ;
+  close(fds[0]);
+  wait();
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int i, fd, runs, window, cat0, cat1, wc0, wc1;
+
+  runs = argc >= 2 ? atoi(argv[1]) : 5;
+  if((fd = open(FILENAME, O_CREATE|O_RDWR)) < 0){
+    printf(2, "rabench: cannot create %s\n", FILENAME);
+    exit();
+  }
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = i % 64 == 63 ? '\n' : 'a' + i % 26;
+  for(i = 0; i < MAXFILE; i++)
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(2, "rabench: write failed\n");
+      exit();
+    }
+  close(fd);
+
+  window = readahead(0);
+  cat0 = wc0 = 0;
+  for(i = 0; i < runs; i++){
+    cat0 += run("cat");
+    wc0 += run("wc");
+  }
+  readahead(window);
+  cat1 = wc1 = 0;
+  for(i = 0; i < runs; i++){
+    cat1 += run("cat");
+    wc1 += run("wc");
+  }
+  printf(1, "rabench: %d runs over %d Kbytes: cat %d ticks, wc %d ticks "
+         "without read-ahead; cat %d ticks, wc %d ticks with %d blocks\n",
+         runs, MAXFILE*BSIZE/1024, cat0, wc0, cat1, wc1, window);
+  unlink(FILENAME);
+  exit();
+}
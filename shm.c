@@ -0,0 +1,148 @@
+// Named shared-memory segments.
+//
+// A segment is a set of zeroed pages with a name. shmat()
+// attaches a segment, creating it if need be, as a shared
+// mmap()-style region (VMA_SHARED) whose vma points at the
+// segment; pagefault() maps the segment's own pages, so every
+// process that attaches it sees the same memory and nothing
+// is ever copied. fork() shares attachments.
+//
+// Each vma that refers to a segment holds a reference to it
+// (shmdup/shmput); the pages are freed when the last one goes,
+// whether by shmdt(), munmap(), exec() or exit().
+//
+// shmwait() and shmwake() let processes sleep on a word of
+// shared memory; they are futex operations (see futex.c).
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+
+struct shm {
+  char name[SHMNAME];
+  int ref;           // vmas referring to this segment; 0 if free
+  uint npages;
+  char *page[SHMMAXPG];
+};
+
+struct {
+  struct spinlock lock;
+  struct shm shm[NSHM];
+} shmtable;
+
+void
+shminit(void)
+{
+  initlock(&shmtable.lock, "shmtable");
+}
+
+// Free the pages of a segment being created, or whose last
+// reference has gone.
+static void
+shmfree(struct shm *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npages; i++)
+    if(s->page[i])
+      kfree(s->page[i]);
+  s->npages = 0;
+  s->name[0] = 0;
+}
+
+// Find the segment called name, or create it with size bytes
+// if there is none, and return it with a new reference.
+// Returns 0 if an existing segment is smaller than size, or
+// if out of memory or segments.
+struct shm*
+shmget(char *name, uint size)
+{
+  struct shm *s, *empty;
+  uint i, npages;
+
+  npages = PGROUNDUP(size) / PGSIZE;
+  if(npages == 0 || npages > SHMMAXPG || name[0] == 0)
+    return 0;
+
+  acquire(&shmtable.lock);
+  empty = 0;
+  for(s = shmtable.shm; s < &shmtable.shm[NSHM]; s++){
+    if(s->ref > 0 && strncmp(s->name, name, SHMNAME) == 0){
+      if(s->npages < npages){
+        release(&shmtable.lock);
+        return 0;
+      }
+      s->ref++;
+      release(&shmtable.lock);
+      return s;
+    }
+    if(s->ref == 0 && empty == 0)
+      empty = s;
+  }
+  if(empty == 0){
+    release(&shmtable.lock);
+    return 0;
+  }
+  s = empty;
+  safestrcpy(s->name, name, SHMNAME);
+  s->npages = npages;
+  for(i = 0; i < npages; i++){
+    if((s->page[i] = kalloc()) == 0){
+      shmfree(s);
+      release(&shmtable.lock);
+      return 0;
+    }
+    memset(s->page[i], 0, PGSIZE);
+  }
+  s->ref = 1;
+  release(&shmtable.lock);
+  return s;
+}
+
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtable.lock);
+  if(s->ref < 1)
+    panic("shmdup");
+  s->ref++;
+  release(&shmtable.lock);
+}
+
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtable.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0)
+    shmfree(s);
+  release(&shmtable.lock);
+}
+
+// Size of a segment in bytes.
+uint
+shmsize(struct shm *s)
+{
+  return s->npages * PGSIZE;
+}
+
+// Return page i of a segment, with a new reference for the
+// caller, or 0 if the segment is not that big.
+char*
+shmpage(struct shm *s, uint i)
+{
+  char *mem;
+
+  acquire(&shmtable.lock);
+  mem = 0;
+  if(i < s->npages){
+    mem = s->page[i];
+    kincref(mem);
+  }
+  release(&shmtable.lock);
+  return mem;
+}
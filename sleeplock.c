@@ -31,6 +31,23 @@ acquiresleep(struct sleeplock *lk)
   release(&lk->lk);
 }
 
+// Like acquiresleep, but return 0 rather than sleep if the
+// lock is held, and 1 once it is acquired.
+int
+tryacquiresleep(struct sleeplock *lk)
+{
+  int r;
+
+  acquire(&lk->lk);
+  r = !lk->locked;
+  if(r){
+    lk->locked = 1;
+    lk->pid = myproc()->pid;
+  }
+  release(&lk->lk);
+  return r;
+}
+
 void
 releasesleep(struct sleeplock *lk)
 {
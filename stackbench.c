@@ -0,0 +1,96 @@
+// Memory used by stacks that grow on demand.
+//
+//   stackbench [kb]
+//
+// NCHILD children each recurse kb Kbytes deep (default 8) and
+// wait there while the free page count is taken. Then they do
+// it again having first touched their whole MAXUSTACK-page
+// stack region, as they would have to pay for if exec() gave
+// every process a stack that large up front.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "meminfo.h"
+
+#define NCHILD 8
+
+int ready[2], done[2];
+
+// Recurse n deep with a kilobyte of stack per call. If stop,
+// tell the parent at the bottom and wait there for it.
+int
+recurse(int n, int stop)
+{
+  volatile int frame[256];
+  char c;
+
+  frame[0] = n;
+  if(n == 0){
+    if(stop){
+      write(ready[1], "r", 1);
+      read(done[0], &c, 1);
+    }
+    return 0;
+  }
+  return recurse(n - 1, stop) + 1 + frame[0] - n;
+}
+
+// Returns the pages used by each child.
+int
+run(int kb, int prefault)
+{
+  struct meminfo m0, m1;
+  int i, n;
+  char c;
+
+  if(pipe(ready) < 0 || pipe(done) < 0){
+    printf(2, "stackbench: pipe failed\n");
+    exit();
+  }
+  meminfo(&m0);
+  for(n = 0; n < NCHILD; n++){
+    if(fork() == 0){
+      close(ready[0]);
+      close(done[1]);
+      // Leave room for the frames above and call overhead.
+      if(prefault)
+        recurse(4*(MAXUSTACK-4), 0);
+      recurse(kb, 1);
+      exit();
+    }
+  }
+  close(ready[1]);
+  close(done[0]);
+  for(i = 0; i < NCHILD; i++){
+    if(read(ready[0], &c, 1) != 1){
+      printf(2, "stackbench: child died\n");
+      exit();
+    }
+  }
+  meminfo(&m1);
+  close(done[1]);
+  close(ready[0]);
+  for(i = 0; i < NCHILD; i++)
+    wait();
+  return (m0.freepages - m1.freepages) / NCHILD;
+}
+
+int
+main(int argc, char *argv[])
+{
+  int kb, grown, full;
+
+  kb = argc >= 2 ? atoi(argv[1]) : 8;
+  if(kb < 0 || kb > 4*(MAXUSTACK-4)){
+    printf(2, "stackbench: at most %d Kbytes\n", 4*(MAXUSTACK-4));
+    exit();
+  }
+  grown = run(kb, 0);
+  full = run(kb, 1);
+  printf(1, "stackbench: %d children recursing %d Kbytes: "
+         "%d pages each with a growing stack, %d with a %d-page "
+         "stack\n", NCHILD, kb, grown, full, MAXUSTACK);
+  exit();
+}
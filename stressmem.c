@@ -0,0 +1,105 @@
+// Oversubscribe memory to exercise swapping.
+//
+//   stressmem [mb]
+//
+// Limits memory in use to mb Mbytes (default 2) more than is in
+// use now, then has NWORKER processes repeatedly write and check
+// one word in every page of their heaps, first with half of the
+// limit in all and then with twice the limit. The second run
+// touches four times as many pages and must swap; any slowdown
+// beyond four times is the cost of swapping. Needs a kernel
+// built with MEMLIMIT=1.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define NWORKER 4
+#define NPASS 4
+
+// Each worker fills its heap before the next starts, so that
+// the first pass of each finds some of its pages swapped out.
+int
+run(int npages)
+{
+  int i, j, k, t0, fds[2], ok;
+  char c, *p;
+
+  if(pipe(fds) < 0){
+    printf(2, "stressmem: pipe failed\n");
+    exit();
+  }
+  t0 = uptime();
+  ok = 1;
+  for(i = 0; i < NWORKER; i++){
+    if(fork() == 0){
+      close(fds[0]);
+      if((p = sbrk(npages*4096)) == (char*)-1){
+        write(fds[1], "x", 1);
+        exit();
+      }
+      for(j = 0; j < npages; j++)
+        *(int*)(p + j*4096) = j;
+      write(fds[1], "a", 1);
+      c = 'o';
+      for(k = 1; k <= NPASS; k++){
+        for(j = 0; j < npages; j++){
+          if(*(int*)(p + j*4096) != j + (k-1)*npages)
+            c = 'x';
+          *(int*)(p + j*4096) = j + k*npages;
+        }
+      }
+      write(fds[1], &c, 1);
+      exit();
+    }
+    if(read(fds[0], &c, 1) != 1 || c != 'a')
+      ok = 0;
+  }
+  close(fds[1]);
+  while(read(fds[0], &c, 1) == 1)
+    if(c != 'o' && c != 'a')
+      ok = 0;
+  close(fds[0]);
+  for(i = 0; i < NWORKER; i++)
+    wait();
+  if(!ok){
+    printf(2, "stressmem: worker failed\n");
+    exit();
+  }
+  return uptime() - t0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  struct meminfo m0, m1;
+  int budget, n, t0, t1;
+
+  budget = (argc >= 2 ? atoi(argv[1]) : 2) * 256;
+  meminfo(&m0);
+  if(m0.swapslots < 2*budget){
+    printf(2, "stressmem: only %d pages of swap\n", m0.swapslots);
+    exit();
+  }
+  // Some slack for page tables and kernel stacks.
+  if(memlimit(m0.totalpages - m0.freepages + budget + 64) < 0){
+    printf(2, "stressmem: memlimit failed; build with MEMLIMIT=1\n");
+    exit();
+  }
+
+  n = budget / 2 / NWORKER;
+  t0 = run(n);
+  printf(1, "stressmem: %d pages touched %d times in %d ticks\n",
+         NWORKER*n, NPASS, t0);
+
+  meminfo(&m0);
+  n = 2 * budget / NWORKER;
+  t1 = run(n);
+  meminfo(&m1);
+  memlimit(0);
+  printf(1, "stressmem: %d pages touched %d times in %d ticks, "
+         "%d swapped out, %d in\n", NWORKER*n, NPASS, t1,
+         m1.swapouts - m0.swapouts, m1.swapins - m0.swapins);
+  exit();
+}
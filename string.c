@@ -28,6 +28,28 @@ memcmp(const void *v1, const void *v2, uint n)
   return 0;
 }
 
+// Copy forward with string moves: a dword at a time once
+// dst is aligned, if src can be aligned with it, else a byte
+// at a time. Safe for overlap when dst is below src.
+static void
+copyforward(char *d, const char *s, uint n)
+{
+  uint head;
+
+  if(n >= 16 && ((uint)d ^ (uint)s) % 4 == 0){
+    head = -(uint)d % 4;
+    movsb(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+    movsl(d, s, n/4);
+    d += n & ~3;
+    s += n & ~3;
+    n %= 4;
+  }
+  movsb(d, s, n);
+}
+
 void*
 memmove(void *dst, const void *src, uint n)
 {
@@ -42,8 +64,7 @@ memmove(void *dst, const void *src, uint n)
     while(n-- > 0)
       *--d = *--s;
   } else
-    while(n-- > 0)
-      *d++ = *s++;
+    copyforward(d, s, n);
 
   return dst;
 }
@@ -52,7 +73,8 @@ memmove(void *dst, const void *src, uint n)
 void*
 memcpy(void *dst, const void *src, uint n)
 {
-  return memmove(dst, src, n);
+  copyforward(dst, src, n);
+  return dst;
 }
 
 int
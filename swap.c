@@ -0,0 +1,182 @@
+// Swapping anonymous user pages to disk.
+//
+// mkfs reserves sb.nswap page-sized slots after the file
+// system on the root disk. When kalloc() runs out of pages
+// and its caller may sleep, it calls swapout(), which asks
+// swapvictim() in proc.c to pick a page that has not been
+// used lately (a clock over the processes' page tables using
+// PTE_A) and writes it to a free slot. The page's PTE keeps
+// the slot number, with PTE_SWAP set and PTE_P clear, and
+// pagefault() calls swapin() to bring the page back.
+//
+// Only private pages with a single reference below the
+// process size are evicted, and only from processes that are
+// neither in a system call, since the kernel may be using their
+// memory while holding a spin lock, nor running, since another
+// CPU's TLB may hold the PTE; the same goes for every thread
+// sharing the page table. fork() shares a slot
+// between parent and child; each slot has a reference count.
+//
+// Swap I/O goes straight to the disk driver with a private
+// struct buf (bprivate()), bypassing the buffer cache, so that
+// swapping does not push out file system blocks. The buffer is
+// allocated once, since swapout() runs when memory is short and
+// a buffer is too big for the kernel stack; swaps take turns
+// with it.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+
+struct {
+  struct spinlock lock;
+  uint dev;
+  uint start;            // first disk block of the swap area
+  uint nslot;            // page slots; 0 until swapinit()
+  uchar ref[NSWAP];      // PTEs holding each slot
+  uchar busy[NSWAP];     // being written by swapout()
+  uint nused;
+  uint nout;             // pages written
+  uint nin;              // pages read back
+  struct buf *buf;       // for swaprw(); its lock orders swaps
+} swap;
+
+// Called from forkret(), once the disk can be read.
+void
+swapinit(int dev)
+{
+  struct superblock sb;
+
+  initlock(&swap.lock, "swap");
+  readsb(dev, &sb);
+  swap.dev = dev;
+  swap.start = sb.swapstart;
+  swap.nslot = sb.nswap < NSWAP ? sb.nswap : NSWAP;
+  if(swap.nslot > 0){
+    bprivate(&swap.buf, 1);
+    releasesleep(&swap.buf->lock);
+  }
+  cprintf("swap: %d pages at block %d\n", swap.nslot, swap.start);
+}
+
+// Read or write page mem from or to slot, a block at a time.
+static void
+swaprw(uint slot, char *mem, int write)
+{
+  struct buf *b = swap.buf;
+  int i;
+
+  acquiresleep(&b->lock);
+  b->dev = swap.dev;
+  for(i = 0; i < SWAPPGBLKS; i++){
+    b->blockno = swap.start + slot*SWAPPGBLKS + i;
+    if(write){
+      memmove(b->data, mem + i*BSIZE, BSIZE);
+      b->flags = B_DIRTY;
+    } else
+      b->flags = 0;
+    iderw(b);
+    if(!write)
+      memmove(mem + i*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&b->lock);
+}
+
+// Evict one page. Returns 0 if a page was freed, -1 if there
+// is no swap space or nothing can be evicted.
+int
+swapout(void)
+{
+  uint slot;
+  char *mem;
+
+  if(swap.nslot == 0)
+    return -1;
+  acquire(&swap.lock);
+  for(slot = 0; slot < swap.nslot; slot++)
+    if(swap.ref[slot] == 0 && !swap.busy[slot])
+      break;
+  if(slot == swap.nslot){
+    release(&swap.lock);
+    return -1;
+  }
+  // Busy until written, so swapin() waits for the data.
+  swap.ref[slot] = 1;
+  swap.busy[slot] = 1;
+  swap.nused++;
+  release(&swap.lock);
+
+  if((mem = swapvictim(slot)) == 0){
+    acquire(&swap.lock);
+    swap.busy[slot] = 0;
+    release(&swap.lock);
+    swapput(slot);
+    return -1;
+  }
+  swaprw(slot, mem, 1);
+  kfree(mem);
+
+  acquire(&swap.lock);
+  swap.busy[slot] = 0;
+  swap.nout++;
+  wakeup(&swap.busy[slot]);
+  release(&swap.lock);
+  return 0;
+}
+
+// Read slot into mem, waiting for swapout() to finish
+// writing it if need be. The caller holds a reference.
+void
+swapin(uint slot, char *mem)
+{
+  if(slot >= swap.nslot)
+    panic("swapin");
+  acquire(&swap.lock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.lock);
+  swap.nin++;
+  release(&swap.lock);
+  swaprw(slot, mem, 0);
+}
+
+// Add a reference to slot, for fork().
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] < 1 || swap.ref[slot] == 255)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot, freeing it with the last.
+void
+swapput(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] < 1)
+    panic("swapput");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Report the swap area size and use, and pages moved.
+void
+swapstat(uint *nslot, uint *nused, uint *nout, uint *nin)
+{
+  acquire(&swap.lock);
+  *nslot = swap.nslot;
+  *nused = swap.nused;
+  *nout = swap.nout;
+  *nin = swap.nin;
+  release(&swap.lock);
+}
@@ -14,6 +14,9 @@
 // to a saved program counter, and then the first argument.
 
 // Fetch the int at addr from the current process.
+// Like argbuf(), fault the memory in first: a page below sz
+// may be absent (not yet loaded, swapped out, or the stack's
+// guard page), and the kernel must not fault on it.
 int
 fetchint(uint addr, int *ip)
 {
@@ -21,26 +24,37 @@ fetchint(uint addr, int *ip)
 
   if(addr >= curproc->sz || addr+4 > curproc->sz)
     return -1;
-  *ip = *(int*)(addr);
+  if(uvmtouch(addr, 4, 0) < 0 || ucopy(ip, (void*)addr, 4) < 0)
+    return -1;
   return 0;
 }
 
-// Fetch the nul-terminated string at addr from the current process.
-// Doesn't actually copy the string - just sets *pp to point at it.
-// Returns length of string, not including nul.
+// Copy the nul-terminated string at addr in the current process
+// into buf, which holds max bytes. Returns the length of the
+// string, not including nul, or -1 if it is longer. Each page
+// is faulted in before it is read, as in fetchint().
 int
-fetchstr(uint addr, char **pp)
+fetchstr(uint addr, char *buf, int max)
 {
-  char *s, *ep;
   struct proc *curproc = myproc();
-
-  if(addr >= curproc->sz)
-    return -1;
-  *pp = (char*)addr;
-  ep = (char*)curproc->sz;
-  for(s = *pp; s < ep; s++){
-    if(*s == 0)
-      return s - *pp;
+  uint a, ea;
+  int n, i;
+
+  for(i = 0; i < max; ){
+    a = addr + i;
+    ea = PGROUNDUP(a + 1);
+    if(a >= curproc->sz || ea <= a)
+      return -1;
+    if(ea > curproc->sz)
+      ea = curproc->sz;
+    n = ea - a;
+    if(n > max - i)
+      n = max - i;
+    if(uvmtouch(a, n, 0) < 0 || ucopy(buf + i, (void*)a, n) < 0)
+      return -1;
+    for(; n > 0; n--, i++)
+      if(buf[i] == 0)
+        return i;
   }
   return -1;
 }
@@ -54,32 +68,53 @@ argint(int n, int *ip)
 
 // Fetch the nth word-sized system call argument as a pointer
 // to a block of memory of size bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+// lies within the process address space: below sz, or in
+// a region made by mmap().
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
   struct proc *curproc = myproc();
  
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || (uint)i+size < (uint)i || (uint)i+size > KERNBASE)
+    return -1;
+  if(((uint)i >= curproc->sz || (uint)i+size > curproc->sz) &&
+     !vmammapped(curproc->pgdir, i, i+size))
+    return -1;
+  // Another thread may unmap the buffer, or fork() may make it
+  // copy-on-write, once it is faulted in, so callers must copy
+  // to and from it with ucopy(), which fails rather than fault.
+  if(uvmtouch(i, size, write) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
 }
 
-// Fetch the nth word-sized system call argument as a string pointer.
-// Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// A buffer the kernel will only read.
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
+// A buffer the kernel will write, such as read()'s.
+int
+argptrw(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
+// Copy the nth word-sized system call argument, a string
+// pointer, into buf of max bytes; see fetchstr().
 int
-argstr(int n, char **pp)
+argstr(int n, char *buf, int max)
 {
   int addr;
   if(argint(n, &addr) < 0)
     return -1;
-  return fetchstr(addr, pp);
+  return fetchstr(addr, buf, max);
 }
 
 extern int sys_chdir(void);
@@ -105,6 +140,22 @@ extern int sys_write(void);
 extern int sys_uptime(void);
 extern int sys_custom_fork(void);
 extern int sys_scheduler_start(void);
+extern int sys_meminfo(void);
+extern int sys_superpages(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_shmwait(void);
+extern int sys_shmwake(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex(void);
+extern int sys_memlimit(void);
+extern int sys_procmem(void);
+extern int sys_rsslimit(void);
+extern int sys_readahead(void);
+extern int sys_dropcache(void);
 
 
 
@@ -132,6 +183,22 @@ static int (*syscalls[])(void) = {
 [SYS_close]   sys_close,
 [SYS_custom_fork] sys_custom_fork,
 [SYS_scheduler_start] sys_scheduler_start,
+[SYS_meminfo] sys_meminfo,
+[SYS_superpages] sys_superpages,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_shmwait] sys_shmwait,
+[SYS_shmwake] sys_shmwake,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex]   sys_futex,
+[SYS_memlimit] sys_memlimit,
+[SYS_procmem] sys_procmem,
+[SYS_rsslimit] sys_rsslimit,
+[SYS_readahead] sys_readahead,
+[SYS_dropcache] sys_dropcache,
 
 
 };
@@ -144,7 +211,11 @@ syscall(void)
 
   num = curproc->tf->eax;
   if(num > 0 && num < NELEM(syscalls) && syscalls[num]) {
+    // The kernel may use this process's memory while holding
+    // a spin lock, so none of it may be swapped out meanwhile.
+    curproc->insyscall = 1;
     curproc->tf->eax = syscalls[num]();
+    curproc->insyscall = 0;
   } else {
     cprintf("%d %s: unknown sys call %d\n",
             curproc->pid, curproc->name, num);
@@ -22,6 +22,22 @@
 #define SYS_close  21
 #define SYS_custom_fork  22
 #define SYS_scheduler_start  23
+#define SYS_meminfo 24
+#define SYS_superpages 25
+#define SYS_mmap 26
+#define SYS_munmap 27
+#define SYS_shmat 28
+#define SYS_shmdt 29
+#define SYS_shmwait 30
+#define SYS_shmwake 31
+#define SYS_clone 32
+#define SYS_join 33
+#define SYS_futex 34
+#define SYS_memlimit 35
+#define SYS_procmem 36
+#define SYS_rsslimit 37
+#define SYS_readahead 38
+#define SYS_dropcache 39
 
 
 
@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "vma.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -73,7 +74,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptrw(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -107,21 +108,24 @@ int
 sys_fstat(void)
 {
   struct file *f;
-  struct stat *st;
+  struct stat st;
+  char *p;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argptrw(1, &p, sizeof(st)) < 0)
+    return -1;
+  if(filestat(f, &st) < 0 || ucopy(p, &st, sizeof(st)) < 0)
     return -1;
-  return filestat(f, st);
+  return 0;
 }
 
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
 {
-  char name[DIRSIZ], *new, *old;
+  char name[DIRSIZ], new[MAXPATH], old[MAXPATH];
   struct inode *dp, *ip;
 
-  if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
+  if(argstr(0, old, MAXPATH) < 0 || argstr(1, new, MAXPATH) < 0)
     return -1;
 
   begin_op();
@@ -186,10 +190,10 @@ sys_unlink(void)
 {
   struct inode *ip, *dp;
   struct dirent de;
-  char name[DIRSIZ], *path;
+  char name[DIRSIZ], path[MAXPATH];
   uint off;
 
-  if(argstr(0, &path) < 0)
+  if(argstr(0, path, MAXPATH) < 0)
     return -1;
 
   begin_op();
@@ -285,12 +289,12 @@ create(char *path, short type, short major, short minor)
 int
 sys_open(void)
 {
-  char *path;
+  char path[MAXPATH];
   int fd, omode;
   struct file *f;
   struct inode *ip;
 
-  if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, &omode) < 0)
     return -1;
 
   begin_op();
@@ -327,6 +331,8 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->raoff = 0;
+  f->rablock = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -335,11 +341,11 @@ sys_open(void)
 int
 sys_mkdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
   }
@@ -352,11 +358,11 @@ int
 sys_mknod(void)
 {
   struct inode *ip;
-  char *path;
+  char path[MAXPATH];
   int major, minor;
 
   begin_op();
-  if((argstr(0, &path)) < 0 ||
+  if((argstr(0, path, MAXPATH)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
      (ip = create(path, T_DEV, major, minor)) == 0){
@@ -371,12 +377,12 @@ sys_mknod(void)
 int
 sys_chdir(void)
 {
-  char *path;
+  char path[MAXPATH];
   struct inode *ip;
   struct proc *curproc = myproc();
   
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
+  if(argstr(0, path, MAXPATH) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
   }
@@ -396,37 +402,50 @@ sys_chdir(void)
 int
 sys_exec(void)
 {
-  char *path, *argv[MAXARG];
-  int i;
+  char path[MAXPATH], *argv[MAXARG], *args;
+  int i, n, r;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+  if(argstr(0, path, MAXPATH) < 0 || argint(1, (int*)&uargv) < 0){
     return -1;
   }
+  // exec() puts the strings in the new stack's first page, so
+  // a page holds them all.
+  if((args = kalloc()) == 0)
+    return -1;
   memset(argv, 0, sizeof(argv));
-  for(i=0;; i++){
+  for(i=0, n=0;; i++){
     if(i >= NELEM(argv))
-      return -1;
+      goto bad;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
-      return -1;
+      goto bad;
     if(uarg == 0){
       argv[i] = 0;
       break;
     }
-    if(fetchstr(uarg, &argv[i]) < 0)
-      return -1;
+    argv[i] = args + n;
+    if(n >= PGSIZE || (r = fetchstr(uarg, argv[i], PGSIZE - n)) < 0)
+      goto bad;
+    n += r + 1;
   }
-  return exec(path, argv);
+  r = exec(path, argv);
+  kfree(args);
+  return r;
+
+bad:
+  kfree(args);
+  return -1;
 }
 
 int
 sys_pipe(void)
 {
-  int *fd;
+  int fd[2];
+  char *p;
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argptrw(0, &p, sizeof(fd)) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -440,5 +459,69 @@ sys_pipe(void)
   }
   fd[0] = fd0;
   fd[1] = fd1;
+  if(ucopy(p, fd, sizeof(fd)) < 0){
+    myproc()->ofile[fd0] = 0;
+    myproc()->ofile[fd1] = 0;
+    fileclose(rf);
+    fileclose(wf);
+    return -1;
+  }
+  return 0;
+}
+
+// Map a file, or zero-filled memory if MAP_ANON, into the
+// address space. addr must be 0: the kernel picks the address.
+int
+sys_mmap(void)
+{
+  struct file *f;
+  struct inode *ip;
+  int addr, len, prot, flags, off, vflags;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 ||
+     argint(2, &prot) < 0 || argint(3, &flags) < 0 ||
+     argint(5, &off) < 0)
+    return -1;
+  if(addr != 0 || len <= 0 || off < 0 || off % PGSIZE != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  vflags = 0;
+  if(prot & PROT_WRITE)
+    vflags |= VMA_WRITE;
+  if(flags & MAP_SHARED)
+    vflags |= VMA_SHARED;
+  ip = 0;
+  if(!(flags & MAP_ANON)){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((vflags & VMA_SHARED) && (vflags & VMA_WRITE) && !f->writable)
+      return -1;
+    ip = f->ip;
+  }
+  return mmapuvm(ip, 0, off, len, vflags);
+}
+
+// Set the number of blocks read ahead of sequential reads, or
+// with a negative argument just report it. Returns the old size.
+int
+sys_readahead(void)
+{
+  int n;
+
+  if(argint(0, &n) < 0)
+    return -1;
+  return readahead(n);
+}
+
+// Empty the buffer cache of blocks not in use, so that the next
+// reads of them go to the disk. That slows everyone, so only
+// kernels built for benchmarks with DROPCACHE have it.
+int
+sys_dropcache(void)
+{
+  if(!DROPCACHE)
+    return -1;
+  bdrop();
   return 0;
 }
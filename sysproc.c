@@ -7,6 +7,9 @@
 #include "mmu.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
+#include "futex.h"
+#include "vma.h"
 
 
 // int sys_sigfg(void){
@@ -48,6 +51,32 @@ sys_wait(void)
   return wait();
 }
 
+int
+sys_clone(void)
+{
+  int fn, arg;
+  char *stack;
+
+  if(argint(0, &fn) < 0 || argint(1, &arg) < 0 ||
+     argptrw(2, &stack, PGSIZE) < 0)
+    return -1;
+  return clone((void(*)(void*))fn, (void*)arg, stack);
+}
+
+int
+sys_join(void)
+{
+  void *stack;
+  char *p;
+  int pid;
+
+  if(argptrw(0, &p, sizeof(stack)) < 0)
+    return -1;
+  if((pid = join(&stack)) >= 0 && ucopy(p, &stack, sizeof(stack)) < 0)
+    return -1;
+  return pid;
+}
+
 int
 sys_kill(void)
 {
@@ -67,15 +96,26 @@ sys_getpid(void)
 int
 sys_sbrk(void)
 {
-  int addr;
   int n;
 
   if(argint(0, &n) < 0)
     return -1;
-  addr = myproc()->sz;
-  if(growproc(n) < 0)
+  return growproc(n);
+}
+
+// Choose whether later sbrk() calls back large, aligned
+// stretches of new memory with 4-Mbyte superpages.
+// Returns the previous setting.
+int
+sys_superpages(void)
+{
+  int on, old;
+
+  if(argint(0, &on) < 0)
     return -1;
-  return addr;
+  old = myproc()->superpages;
+  myproc()->superpages = (on != 0);
+  return old;
 }
 
 int
@@ -111,3 +151,154 @@ sys_uptime(void)
   release(&tickslock);
   return xticks;
 }
+
+// Remove mmap() regions in [addr, addr+len).
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0)
+    return -1;
+  return munmapuvm(addr, len);
+}
+
+// Attach the shared-memory segment called name, creating it
+// with size bytes if it does not exist.
+int
+sys_shmat(void)
+{
+  char name[MAXPATH];
+  int size, addr;
+  struct shm *s;
+
+  if(argstr(0, name, MAXPATH) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  if((s = shmget(name, size)) == 0)
+    return -1;
+  addr = mmapuvm(0, s, 0, shmsize(s), VMA_SHARED|VMA_WRITE);
+  shmput(s);
+  return addr;
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return shmdetach(addr);
+}
+
+// shmwait() and shmwake() are futex operations; shmwake()
+// wakes every sleeper.
+int
+sys_shmwait(void)
+{
+  int *addr, val;
+
+  if(argptrw(0, (char**)&addr, sizeof(*addr)) < 0 || argint(1, &val) < 0)
+    return -1;
+  return futexwait(addr, val) < 0 ? -1 : 0;
+}
+
+int
+sys_shmwake(void)
+{
+  int *addr;
+
+  if(argptrw(0, (char**)&addr, sizeof(*addr)) < 0)
+    return -1;
+  return futexwake(addr, NPROC) < 0 ? -1 : 0;
+}
+
+// futex(addr, FUTEX_WAIT, val) sleeps if *addr == val;
+// futex(addr, FUTEX_WAKE, n) wakes up to n sleepers on addr.
+// The word is faulted in writable so that its physical
+// address, which names it, is settled.
+int
+sys_futex(void)
+{
+  int *addr, op, val;
+
+  if(argptrw(0, (char**)&addr, sizeof(*addr)) < 0 ||
+     argint(1, &op) < 0 || argint(2, &val) < 0)
+    return -1;
+  switch(op){
+  case FUTEX_WAIT:
+    return futexwait(addr, val);
+  case FUTEX_WAKE:
+    return futexwake(addr, val);
+  }
+  return -1;
+}
+
+// Report system-wide memory usage.
+int
+sys_meminfo(void)
+{
+  struct meminfo mi;
+  char *p;
+
+  if(argptrw(0, &p, sizeof(mi)) < 0)
+    return -1;
+  kmemstat(&mi.freepages, &mi.totalpages);
+  pcstat(&mi.cachepages, &mi.cachehits, &mi.cachemisses);
+  swapstat(&mi.swapslots, &mi.swapused, &mi.swapouts, &mi.swapins);
+  kbuddystat(mi.freeblocks);
+  bstat(&mi.bufs, &mi.bufhits, &mi.bufmisses);
+  idestat(&mi.diskreads, &mi.diskwrites, &mi.diskcmds, &mi.diskseek,
+          &mi.diskcpu);
+  logstat(&mi.logsize, &mi.logcommits, &mi.logwaits, &mi.logckpts);
+  return ucopy(p, &mi, sizeof(mi));
+}
+
+// Allow at most n pages of memory in use, swapping beyond
+// that; 0 removes the limit. The limit is for everyone, so only
+// kernels built for testing swap with MEMLIMIT have it.
+int
+sys_memlimit(void)
+{
+  int n;
+
+  if(!MEMLIMIT || argint(0, &n) < 0 || n < 0)
+    return -1;
+  kmemlimit(n);
+  return 0;
+}
+
+// Report the memory use of up to n processes.
+int
+sys_procmem(void)
+{
+  struct procmem *pm;
+  char *p;
+  int n;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NPROC)
+    return -1;
+  if(n > PGSIZE / sizeof(*pm))
+    n = PGSIZE / sizeof(*pm);
+  if(argptrw(0, &p, n*sizeof(*pm)) < 0)
+    return -1;
+  // Filled in under ptable.lock, so in a kernel page first.
+  if((pm = (struct procmem*)kalloc()) == 0)
+    return -1;
+  n = procmem(pm, n);
+  if(ucopy(p, pm, n*sizeof(*pm)) < 0)
+    n = -1;
+  kfree((char*)pm);
+  return n;
+}
+
+// Limit a process's resident pages.
+int
+sys_rsslimit(void)
+{
+  int pid, n;
+
+  if(argint(0, &pid) < 0 || argint(1, &n) < 0)
+    return -1;
+  return rsslimit(pid, n);
+}
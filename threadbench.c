@@ -0,0 +1,266 @@
+// Thread benchmarks.
+//
+//   threadbench sum [n]   sum a 1-Mbyte array n times, split
+//                         four ways between threads and then
+//                         between forked processes
+//   threadbench lock [n]  n uncontended lock/unlock pairs and n
+//                         contended ones, with futex mutexes
+//                         and with spin locks, then n/100 lock
+//                         handoffs between two threads with a
+//                         condition variable and with sleep(1)
+//                         polling
+//
+// Times are in clock ticks.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+
+#define NWORKER 4
+#define NELEM (256*1024)
+
+int data[NELEM];
+uint partial[NWORKER];
+
+static uint
+sumrange(int i)
+{
+  int j, lo, hi;
+  uint s;
+
+  lo = i * (NELEM / NWORKER);
+  hi = lo + NELEM / NWORKER;
+  s = 0;
+  for(j = lo; j < hi; j++)
+    s += data[j];
+  return s;
+}
+
+void
+sumthread(void *arg)
+{
+  partial[(int)arg] = sumrange((int)arg);
+  exit();
+}
+
+static uint
+threadsum(void)
+{
+  int i;
+  uint s;
+
+  for(i = 0; i < NWORKER; i++){
+    if(thread_create(sumthread, (void*)i) < 0){
+      printf(2, "threadbench: thread_create failed\n");
+      exit();
+    }
+  }
+  while(thread_join() > 0)
+    ;
+  s = 0;
+  for(i = 0; i < NWORKER; i++)
+    s += partial[i];
+  return s;
+}
+
+// Each child copies-on-write its own address space and
+// sends its partial sum back through a pipe.
+static uint
+forksum(void)
+{
+  int i, fds[2];
+  uint s, p;
+
+  if(pipe(fds) < 0){
+    printf(2, "threadbench: pipe failed\n");
+    exit();
+  }
+  for(i = 0; i < NWORKER; i++){
+    if((p = fork()) == 0){
+      close(fds[0]);
+      p = sumrange(i);
+      write(fds[1], &p, sizeof(p));
+      exit();
+    }
+    if((int)p < 0){
+      printf(2, "threadbench: fork failed\n");
+      exit();
+    }
+  }
+  close(fds[1]);
+  s = 0;
+  for(i = 0; i < NWORKER; i++){
+    if(read(fds[0], &p, sizeof(p)) != sizeof(p)){
+      printf(2, "threadbench: short read\n");
+      exit();
+    }
+    s += p;
+  }
+  close(fds[0]);
+  for(i = 0; i < NWORKER; i++)
+    wait();
+  return s;
+}
+
+void
+sumbench(int n)
+{
+  int i, t0, t1, t2;
+  uint s1, s2;
+
+  for(i = 0; i < NELEM; i++)
+    data[i] = i;
+  s1 = s2 = 0;
+  t0 = uptime();
+  for(i = 0; i < n; i++)
+    s1 = threadsum();
+  t1 = uptime();
+  for(i = 0; i < n; i++)
+    s2 = forksum();
+  t2 = uptime();
+  if(s1 != s2)
+    printf(2, "threadbench: thread and fork sums differ\n");
+  printf(1, "sum: %d sums of %d Kbytes by %d workers: "
+         "threads %d ticks, processes %d ticks\n",
+         n, NELEM * sizeof(int) / 1024, NWORKER, t1 - t0, t2 - t1);
+}
+
+mutex_t mutex;
+lock_t spin;
+cond_t turncond;
+volatile int turn;
+int nlocks, usespin;
+volatile int counter;
+
+void
+lockthread(void *arg)
+{
+  int i;
+
+  for(i = 0; i < nlocks; i++){
+    if(usespin){
+      lock_acquire(&spin);
+      counter++;
+      lock_release(&spin);
+    } else {
+      mutex_lock(&mutex);
+      counter++;
+      mutex_unlock(&mutex);
+    }
+  }
+  exit();
+}
+
+// Time NWORKER threads each taking the lock n/NWORKER times.
+static int
+contended(int n, int spinning)
+{
+  int i, t0;
+
+  nlocks = n / NWORKER;
+  usespin = spinning;
+  counter = 0;
+  t0 = uptime();
+  for(i = 0; i < NWORKER; i++){
+    if(thread_create(lockthread, 0) < 0){
+      printf(2, "threadbench: thread_create failed\n");
+      exit();
+    }
+  }
+  while(thread_join() > 0)
+    ;
+  if(counter != nlocks * NWORKER)
+    printf(2, "threadbench: lost updates\n");
+  return uptime() - t0;
+}
+
+// Pass the turn back and forth: thread me waits for turn == me
+// and hands it to the other, n times.
+static void
+handoff(int me, int n, int poll)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(poll){
+      while(turn != me)
+        sleep(1);
+      turn = !me;
+      continue;
+    }
+    mutex_lock(&mutex);
+    while(turn != me)
+      cond_wait(&turncond, &mutex);
+    turn = !me;
+    cond_signal(&turncond);
+    mutex_unlock(&mutex);
+  }
+}
+
+void
+handoffthread(void *arg)
+{
+  handoff(1, nlocks, usespin);
+  exit();
+}
+
+static int
+handoffs(int n, int poll)
+{
+  int t0;
+
+  nlocks = n;
+  usespin = poll;
+  turn = 0;
+  t0 = uptime();
+  if(thread_create(handoffthread, 0) < 0){
+    printf(2, "threadbench: thread_create failed\n");
+    exit();
+  }
+  handoff(0, n, poll);
+  thread_join();
+  return uptime() - t0;
+}
+
+void
+lockbench(int n)
+{
+  int i, t0, t1, t2;
+
+  mutex_init(&mutex);
+  lock_init(&spin);
+  cond_init(&turncond);
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    mutex_lock(&mutex);
+    mutex_unlock(&mutex);
+  }
+  t1 = uptime();
+  for(i = 0; i < n; i++){
+    lock_acquire(&spin);
+    lock_release(&spin);
+  }
+  t2 = uptime();
+  printf(1, "lock: %d uncontended: mutex %d ticks, spin lock %d ticks\n",
+         n, t1 - t0, t2 - t1);
+  t0 = contended(n, 0);
+  t1 = contended(n, 1);
+  printf(1, "lock: %d contended by %d threads: mutex %d ticks, "
+         "spin lock %d ticks\n", n, NWORKER, t0, t1);
+  t0 = handoffs(n / 100, 0);
+  t1 = handoffs(n / 100, 1);
+  printf(1, "lock: %d handoffs: condition variable %d ticks, "
+         "sleep(1) polling %d ticks\n", n / 100, t0, t1);
+}
+
+int
+main(int argc, char *argv[])
+{
+  if(argc >= 2 && strcmp(argv[1], "sum") == 0)
+    sumbench(argc >= 3 ? atoi(argv[2]) : 20);
+  else if(argc >= 2 && strcmp(argv[1], "lock") == 0)
+    lockbench(argc >= 3 ? atoi(argv[2]) : 100000);
+  else
+    printf(2, "usage: threadbench sum|lock [n]\n");
+  exit();
+}
@@ -11,6 +11,7 @@
 // Interrupt descriptor table (shared by all CPUs).
 struct gatedesc idt[256];
 extern uint vectors[];  // in vectors.S: array of 256 entry pointers
+extern char ucopyfault[], ucopyfail[];  // in trapasm.S
 struct spinlock tickslock;
 uint ticks;
 
@@ -36,6 +37,8 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  uint va;
+
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
       exit();
@@ -81,6 +84,11 @@ trap(struct trapframe *tf)
     uartintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_TLB:
+    lcr3(rcr3());
+    mycpu()->tlbflushes++;
+    lapiceoi();
+    break;
   case T_IRQ0 + 7:
   case T_IRQ0 + IRQ_SPURIOUS:
     cprintf("cpu%d: spurious interrupt at %x:%x\n",
@@ -88,8 +96,37 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Demand-paged or copy-on-write user memory, touched by the
+    // process. System calls fault in the user memory they use
+    // first (argbuf(), fetchint(), fetchstr()), so that a bad
+    // address or a lack of memory fails the call instead of
+    // reaching the panic below, and then copy with ucopy(). A
+    // fault in ucopy() means another thread has unmapped the
+    // memory or fork() has made it copy-on-write since; it may
+    // hold a spin lock or the inode lock a fault would need, so
+    // make ucopy() fail instead. pagefault() may sleep and wait
+    // for other CPUs to flush their TLBs, so it runs only for
+    // code that had interrupts on, and with them on.
+    if((tf->cs&3) == 0 && tf->eip == (uint)ucopyfault &&
+       rcr2() < KERNBASE){
+      tf->eip = (uint)ucopyfail;
+      break;
+    }
+    if(myproc() && (va = rcr2()) < KERNBASE && (tf->eflags & FL_IF)){
+      sti();
+      if(pagefault(va, tf->err) == 0)
+        break;
+    }
+    // Otherwise a real fault: fall through.
+
   //PAGEBREAK: 13
   default:
+    if(virtioirq >= 0 && tf->trapno == T_IRQ0 + virtioirq){
+      virtiointr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
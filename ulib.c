@@ -3,6 +3,7 @@
 #include "fcntl.h"
 #include "user.h"
 #include "x86.h"
+#include "futex.h"
 
 char*
 strcpy(char *s, const char *t)
@@ -98,9 +99,102 @@ memmove(void *vdst, const void *vsrc, int n)
   char *dst;
   const char *src;
 
+  if(n <= 0)
+    return vdst;
   dst = vdst;
   src = vsrc;
-  while(n-- > 0)
-    *dst++ = *src++;
+  if(((uint)dst | (uint)src) % 4 == 0){
+    movsl(dst, src, n/4);
+    dst += n & ~3;
+    src += n & ~3;
+    n %= 4;
+  }
+  movsb(dst, src, n);
   return vdst;
 }
+
+// Spin locks for threads, like the kernel's.
+void
+lock_init(lock_t *lk)
+{
+  lk->locked = 0;
+}
+
+void
+lock_acquire(lock_t *lk)
+{
+  while(xchg(&lk->locked, 1) != 0)
+    ;
+}
+
+void
+lock_release(lock_t *lk)
+{
+  xchg(&lk->locked, 0);
+}
+
+// Mutexes that sleep in the kernel rather than spin. state is
+// 0 if unlocked, 1 if locked, and 2 if locked and someone may
+// be sleeping on it, so an uncontended lock and unlock never
+// enter the kernel.
+void
+mutex_init(mutex_t *m)
+{
+  m->state = 0;
+}
+
+void
+mutex_lock(mutex_t *m)
+{
+  if(xchg(&m->state, 1) == 0)
+    return;
+  // Setting 2 may hide a plain 1, at the cost of one
+  // unneeded wakeup later.
+  while(xchg(&m->state, 2) != 0)
+    futex((int*)&m->state, FUTEX_WAIT, 2);
+}
+
+void
+mutex_unlock(mutex_t *m)
+{
+  if(xchg(&m->state, 0) == 2)
+    futex((int*)&m->state, FUTEX_WAKE, 1);
+}
+
+// Condition variables. seq changes with every signal, so a
+// signal after cond_wait() releases the mutex but before it
+// sleeps makes the futex wait return at once. Like sleep() and
+// wakeup() in the kernel, callers recheck their condition in a
+// loop, and must hold the mutex to signal.
+void
+cond_init(cond_t *c)
+{
+  c->seq = 0;
+}
+
+void
+cond_wait(cond_t *c, mutex_t *m)
+{
+  uint seq;
+
+  seq = c->seq;
+  mutex_unlock(m);
+  futex((int*)&c->seq, FUTEX_WAIT, seq);
+  // Others may be waiting for the mutex too.
+  while(xchg(&m->state, 2) != 0)
+    futex((int*)&m->state, FUTEX_WAIT, 2);
+}
+
+void
+cond_signal(cond_t *c)
+{
+  c->seq++;
+  futex((int*)&c->seq, FUTEX_WAKE, 1);
+}
+
+void
+cond_broadcast(cond_t *c)
+{
+  c->seq++;
+  futex((int*)&c->seq, FUTEX_WAKE, 0x7fffffff);
+}
@@ -1,5 +1,19 @@
 struct stat;
 struct rtcdate;
+struct meminfo;
+struct procmem;
+
+typedef struct {
+  volatile uint locked;
+} lock_t;
+
+typedef struct {
+  volatile uint state;   // see mutex_lock() in ulib.c
+} mutex_t;
+
+typedef struct {
+  volatile uint seq;
+} cond_t;
 
 // system calls
 int fork(void);
@@ -25,6 +39,22 @@ int sleep(int);
 int uptime(void);
 int custom_fork(int start_later, int exec_time);
 int scheduler_start(void);
+int meminfo(struct meminfo*);
+int superpages(int);
+void* mmap(void*, int, int, int, int, int);
+int munmap(void*, int);
+void* shmat(char*, int);
+int shmdt(void*);
+int shmwait(int*, int);
+int shmwake(int*);
+int clone(void(*)(void*), void*, void*);
+int join(void**);
+int futex(int*, int, int);
+int memlimit(int);
+int procmem(struct procmem*, int);
+int rsslimit(int, int);
+int readahead(int);
+int dropcache(void);
 
 
 
@@ -42,3 +72,15 @@ void* memset(void*, int, uint);
 void* malloc(uint);
 void free(void*);
 int atoi(const char*);
+int thread_create(void(*)(void*), void*);
+int thread_join(void);
+void lock_init(lock_t*);
+void lock_acquire(lock_t*);
+void lock_release(lock_t*);
+void mutex_init(mutex_t*);
+void mutex_lock(mutex_t*);
+void mutex_unlock(mutex_t*);
+void cond_init(cond_t*);
+void cond_wait(cond_t*, mutex_t*);
+void cond_signal(cond_t*);
+void cond_broadcast(cond_t*);
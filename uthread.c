@@ -0,0 +1,33 @@
+// Threads. A thread runs fn(arg) on a one-page stack from
+// malloc(), which thread_join() frees; fn must call exit().
+// malloc() itself is not thread-safe, so create and join
+// threads from one thread only. The spin locks are in ulib.c.
+// Kept out of ulib.c so that forktest need not link malloc.
+
+#include "types.h"
+#include "user.h"
+#include "mmu.h"
+
+int
+thread_create(void (*fn)(void*), void *arg)
+{
+  void *stack;
+  int pid;
+
+  if((stack = malloc(PGSIZE)) == 0)
+    return -1;
+  if((pid = clone(fn, arg, stack)) < 0)
+    free(stack);
+  return pid;
+}
+
+int
+thread_join(void)
+{
+  void *stack;
+  int pid;
+
+  if((pid = join(&stack)) >= 0)
+    free(stack);
+  return pid;
+}
@@ -0,0 +1,304 @@
+// Driver for a virtio block device on the PCI bus, through the
+// legacy virtio interface, as QEMU offers it for
+// -drive file=fs.img,if=virtio (make qemu-virtio). If there is
+// one, ideinit() uses it for disk 1 in place of the IDE disk,
+// and idesubmit() hands it disk 1's requests.
+//
+// Requests go on one virtqueue, as chains of descriptors: a
+// header naming the operation and sector, the data of each buf,
+// and a status byte the device fills in. As many requests as
+// there are descriptors for are at the device at once; the rest
+// wait on vt.pending until interrupts give descriptors back.
+// Like idestart(), vtsubmit() makes one request of a run of
+// pending bufs for consecutive blocks in the same direction, up
+// to VTMERGE of them, chained by qnext. The
+// caller of virtiostart() holds idelock, which also covers the
+// virtqueue, and virtiointr() completes requests through
+// idedone(), like ideintr().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+
+#define VIRTIO_VENDOR   0x1af4
+#define VIRTIO_BLK      0x1001  // block device, legacy id
+
+// Legacy virtio registers, in the I/O space of BAR 0.
+#define VIO_GUESTFEAT   0x04  // features the driver uses
+#define VIO_QPFN        0x08  // page number of the selected queue
+#define VIO_QSIZE       0x0c  // entries in the selected queue
+#define VIO_QSEL        0x0e  // queue select
+#define VIO_QNOTIFY     0x10  // write queue number when there is work
+#define VIO_STATUS      0x12  // device status
+#define VIO_ISR         0x13  // interrupt status; reading clears it
+#define VIO_CAPACITY    0x14  // block config: sectors, 64 bits
+
+#define VIO_ST_ACK      1
+#define VIO_ST_DRIVER   2
+#define VIO_ST_OK       4
+#define VIO_ST_FAILED   0x80
+
+#define VRING_NEXT      1     // descriptor continues in next
+#define VRING_WRITE     2     // device writes the buffer
+
+#define VIRTIO_BLK_IN   0     // read
+#define VIRTIO_BLK_OUT  1     // write
+
+#define NVRING        256     // largest virtqueue we can lay out
+#define NVREQ  (NVRING/3)     // most requests at the device
+
+// Most bufs in one request: IDEMERGE, as for the IDE disk, but
+// few enough that virtiointr() can collect a request's bufs.
+#define VTMERGE (IDEMERGE < 32 ? IDEMERGE : 32)
+
+struct vringdesc {
+  uint64 addr;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vringavail {
+  ushort flags;
+  ushort idx;
+  ushort ring[];
+};
+
+struct vringused {
+  ushort flags;
+  ushort idx;
+  struct {
+    uint id;
+    uint len;
+  } ring[];
+};
+
+struct vtreq {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+
+// The virtqueue: descriptors, then the available ring, then,
+// on the next page, the used ring. Physically contiguous, as
+// the device requires, being in the kernel's bss.
+static uchar vring[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  uint port;
+  uint nring;            // virtqueue entries
+  uint capacity;         // blocks on the device
+  struct vringdesc *desc;
+  struct vringavail *avail;
+  struct vringused *used;
+  ushort usedidx;        // used ring entries seen
+  ushort free[NVRING];   // free descriptors
+  uint nfree;
+  struct {
+    struct vtreq hdr;
+    uchar status;
+    struct buf *b;
+  } req[NVRING];         // by first descriptor of chain
+  struct buf *pending;   // waiting for descriptors
+  struct buf **pendtail;
+  uint reads, writes, cmds;
+  uint64 cycles;
+} vt;
+
+int virtioirq = -1;
+
+// Find and set up the device. Returns 0, or -1 if there is no
+// usable one.
+int
+virtioinit(void)
+{
+  struct pcidev d;
+  uint i, n;
+
+  if(pcifind(VIRTIO_VENDOR, VIRTIO_BLK, PCI_ANY, PCI_ANY, &d) < 0)
+    return -1;
+  pciwrite(&d, PCI_CMD, pciread(&d, PCI_CMD) | PCI_CMD_IO | PCI_CMD_MASTER);
+  vt.port = d.bar[0];
+
+  outb(vt.port + VIO_STATUS, 0);  // reset
+  outb(vt.port + VIO_STATUS, VIO_ST_ACK);
+  outb(vt.port + VIO_STATUS, VIO_ST_ACK|VIO_ST_DRIVER);
+  outl(vt.port + VIO_GUESTFEAT, 0);
+
+  outw(vt.port + VIO_QSEL, 0);
+  n = inw(vt.port + VIO_QSIZE);
+  if(n < 3 || n > NVRING || (n & (n-1)) != 0){
+    cprintf("virtio-blk: cannot use a queue of %d\n", n);
+    outb(vt.port + VIO_STATUS, VIO_ST_FAILED);
+    return -1;
+  }
+  vt.nring = n;
+  vt.desc = (struct vringdesc*)vring;
+  vt.avail = (struct vringavail*)(vring + n*sizeof(struct vringdesc));
+  vt.used = (struct vringused*)(vring +
+    PGROUNDUP(n*sizeof(struct vringdesc) + sizeof(ushort)*(3 + n)));
+  outl(vt.port + VIO_QPFN, V2P(vring) / PGSIZE);
+  for(i = 0; i < n; i++)
+    vt.free[i] = i;
+  vt.nfree = n;
+  vt.pendtail = &vt.pending;
+  vt.capacity = inl(vt.port + VIO_CAPACITY) / (BSIZE/512);
+
+  outb(vt.port + VIO_STATUS, VIO_ST_ACK|VIO_ST_DRIVER|VIO_ST_OK);
+  virtioirq = d.irq;
+  ioapicenable(d.irq, ncpu - 1);
+  cprintf("virtio-blk: disk 1 at port 0x%x irq %d, %d blocks\n",
+          vt.port, d.irq, vt.capacity);
+  return 0;
+}
+
+// Take a free descriptor and fill it in.
+static ushort
+vtdesc(uint pa, uint len, ushort flags, ushort next)
+{
+  ushort i;
+
+  i = vt.free[--vt.nfree];
+  vt.desc[i].addr = pa;
+  vt.desc[i].len = len;
+  vt.desc[i].flags = flags;
+  vt.desc[i].next = next;
+  return i;
+}
+
+// Put as many pending requests on the virtqueue as there are
+// descriptors for, and tell the device once about them all.
+static void
+vtsubmit(void)
+{
+  struct buf *b, *p, *run[VTMERGE];
+  ushort d, d0, ds;
+  int n, i, nb, write;
+
+  for(n = 0; vt.pending && vt.nfree >= 3; n++){
+    b = vt.pending;
+    write = b->flags & B_DIRTY;
+    run[0] = b;
+    for(nb = 1; nb < VTMERGE && vt.nfree >= nb + 3; nb++){
+      p = run[nb-1]->qnext;
+      if(p == 0 || p->dev != b->dev ||
+         p->blockno != run[nb-1]->blockno + 1 ||
+         (p->flags & B_DIRTY) != write)
+        break;
+      run[nb] = p;
+    }
+    if((vt.pending = run[nb-1]->qnext) == 0)
+      vt.pendtail = &vt.pending;
+    run[nb-1]->qnext = 0;
+    if(run[nb-1]->blockno >= vt.capacity)
+      panic("virtio-blk: block out of range");
+    vt.cmds++;
+    if(write)
+      vt.writes += nb;
+    else
+      vt.reads += nb;
+
+    // Descriptors are taken from the top of the free stack, so
+    // the chain is built from its end.
+    d = ds = vtdesc(0, 1, VRING_WRITE, 0);
+    for(i = nb-1; i >= 0; i--)
+      d = vtdesc(V2P(run[i]->data), BSIZE,
+                 VRING_NEXT | (write ? 0 : VRING_WRITE), d);
+    d0 = vtdesc(0, sizeof(struct vtreq), VRING_NEXT, d);
+    vt.req[d0].hdr.type = write ? VIRTIO_BLK_OUT : VIRTIO_BLK_IN;
+    vt.req[d0].hdr.reserved = 0;
+    vt.req[d0].hdr.sector = (uint64)b->blockno * (BSIZE/512);
+    vt.req[d0].status = 0xff;
+    vt.req[d0].b = b;
+    vt.desc[d0].addr = V2P(&vt.req[d0].hdr);
+    vt.desc[ds].addr = V2P(&vt.req[d0].status);
+
+    vt.avail->ring[vt.avail->idx % vt.nring] = d0;
+    __sync_synchronize();  // ring entry before index
+    vt.avail->idx++;
+  }
+  if(n > 0){
+    __sync_synchronize();  // index before notify
+    outw(vt.port + VIO_QNOTIFY, 0);
+  }
+}
+
+// Queue b's transfer. Caller must hold idelock.
+void
+virtiostart(struct buf *b)
+{
+  uint64 t0;
+
+  t0 = rdtsc();
+  b->qnext = 0;
+  *vt.pendtail = b;
+  vt.pendtail = &b->qnext;
+  vtsubmit();
+  vt.cycles += rdtsc() - t0;
+}
+
+// Interrupt handler.
+void
+virtiointr(void)
+{
+  struct buf *done[NVREQ], *b;
+  ushort d;
+  int n;
+  uint64 t0;
+
+  t0 = rdtsc();
+  acquire(&idelock);
+  if(!(inb(vt.port + VIO_ISR) & 1)){
+    // A configuration change, or another device on the line.
+    release(&idelock);
+    return;
+  }
+
+  for(n = 0; vt.usedidx != vt.used->idx; vt.usedidx++){
+    if(n + VTMERGE > NELEM(done)){
+      // Finish those so far to make room; idedone() releases
+      // idelock.
+      idedone(done, n);
+      acquire(&idelock);
+      n = 0;
+    }
+    __sync_synchronize();  // index before ring entry
+    d = vt.used->ring[vt.usedidx % vt.nring].id;
+    if(vt.req[d].status != 0)
+      panic("virtio-blk: request failed");
+    for(b = vt.req[d].b; b; b = b->qnext)
+      done[n++] = b;
+    vt.req[d].b = 0;
+    for(;;){
+      vt.free[vt.nfree++] = d;
+      if(!(vt.desc[d].flags & VRING_NEXT))
+        break;
+      d = vt.desc[d].next;
+    }
+  }
+
+  vtsubmit();
+  vt.cycles += rdtsc() - t0;
+  idedone(done, n);
+}
+
+// Add the device's counts to the IDE disk's, for idestat().
+// Every request is a command, and nothing seeks. Caller must
+// hold idelock.
+void
+virtiostat(uint *reads, uint *writes, uint *cmds, uint64 *cycles)
+{
+  *reads += vt.reads;
+  *writes += vt.writes;
+  *cmds += vt.cmds;
+  *cycles += vt.cycles;
+}
@@ -5,11 +5,27 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
+#include "traps.h"
 #include "elf.h"
+#include "stat.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "vma.h"
+#include "meminfo.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
 
+// A page of zeros, mapped read-only wherever a process has
+// memory that should read as zero but has not been written:
+// heap from sbrk() and untouched BSS. PTE_ZERO marks mappings
+// that may be written, which fault and get a page of their own
+// (see pagefault). It carries no reference counts, since it
+// is never freed.
+char *zeropage;
+
 // Set up CPU's kernel segment descriptors.
 // Run once on entry on each CPU.
 void
@@ -39,6 +55,8 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    panic("walkpgdir: superpage");
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
@@ -79,6 +97,37 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
   return 0;
 }
 
+// Like mappages, but map the parts of the range that are 4-Mbyte
+// aligned (in both va and pa) with single PTE_PS superpage
+// entries, so they need no page table page at all. Only used
+// for the kernel mappings made by setupkvm().
+static int
+mapkpages(pde_t *pgdir, uint va, uint size, uint pa, int perm)
+{
+  uint n;
+
+  while(size > 0){
+    if(va % SUPERPGSIZE == 0 && pa % SUPERPGSIZE == 0 &&
+       size >= SUPERPGSIZE){
+      if(pgdir[PDX(va)] & PTE_P)
+        panic("remap");
+      pgdir[PDX(va)] = pa | perm | PTE_P | PTE_PS;
+      n = SUPERPGSIZE;
+    } else {
+      // Small pages up to the next superpage boundary.
+      n = SUPERPGSIZE - va % SUPERPGSIZE;
+      if(n > size)
+        n = size;
+      if(mappages(pgdir, (void*)va, n, pa, perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // There is one page table per process, plus one that's used when
 // a CPU is not running any process (kpgdir). The kernel uses the
 // current process's page table during system calls and interrupts;
@@ -96,6 +145,14 @@ mappages(pde_t *pgdir, void *va, uint size, uint pa, int perm)
 //                                  rw data + free physical memory
 //   0xfe000000..0: mapped direct (devices such as ioapic)
 //
+// Above the first 4 Mbytes, the kernel mappings use 4-Mbyte
+// superpages (PTE_PS; CR4_PSE is enabled in entry.S), so the
+// kernel half needs only one page table page, which all page
+// tables share. The first 4 Mbytes use small pages to keep
+// kernel text read-only. All kernel mappings are global (PTE_G;
+// CR4_PGE is enabled in entry.S), so switching page tables
+// flushes only user entries from the TLB.
+//
 // The kernel allocates physical memory for its heap and for user memory
 // between V2P(end) and the end of physical memory (PHYSTOP)
 // (directly addressable from end..P2V(PHYSTOP)).
@@ -115,33 +172,45 @@ static struct kmap {
 };
 
 // Set up kernel part of a page table.
+// The kernel half of the address space is the same in every
+// page table and never changes after boot, so instead of being
+// rebuilt it is copied from kpgdir a directory entry at a time,
+// and the page table pages it points to are shared.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE) * sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE)) * sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes, holding the mappings in kmap[]
+// that setupkvm() copies into every other page table.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkpages(kpgdir, (uint)k->virt, k->phys_end - k->phys_start,
+                 (uint)k->phys_start, k->perm | PTE_G) < 0)
+      panic("kvmalloc");
   switchkvm();
+
+  if((zeropage = kalloc()) == 0)
+    panic("kvmalloc: zeropage");
+  memset(zeropage, 0, PGSIZE);
 }
 
 // Switch h/w page table register to the kernel-only page table,
@@ -152,16 +221,16 @@ switchkvm(void)
   lcr3(V2P(kpgdir));   // switch to the kernel page table
 }
 
-// Switch TSS and h/w page table to correspond to process p.
+// Switch TSS to correspond to process p, leaving the h/w page
+// table alone. The scheduler uses this instead of switchuvm()
+// when %cr3 already holds p's page table, to keep the TLB.
 void
-switchuvm(struct proc *p)
+switchtss(struct proc *p)
 {
   if(p == 0)
-    panic("switchuvm: no process");
+    panic("switchtss: no process");
   if(p->kstack == 0)
-    panic("switchuvm: no kstack");
-  if(p->pgdir == 0)
-    panic("switchuvm: no pgdir");
+    panic("switchtss: no kstack");
 
   pushcli();
   mycpu()->gdt[SEG_TSS] = SEG16(STS_T32A, &mycpu()->ts,
@@ -173,10 +242,71 @@ switchuvm(struct proc *p)
   // forbids I/O instructions (e.g., inb and outb) from user space
   mycpu()->ts.iomb = (ushort) 0xFFFF;
   ltr(SEG_TSS << 3);
+  popcli();
+}
+
+// Switch TSS and h/w page table to correspond to process p.
+void
+switchuvm(struct proc *p)
+{
+  if(p == 0)
+    panic("switchuvm: no process");
+  if(p->pgdir == 0)
+    panic("switchuvm: no pgdir");
+
+  switchtss(p);
+  pushcli();
+  mycpu()->pgdir = p->pgdir;  // before the load; see uvmflush()
   lcr3(V2P(p->pgdir));  // switch to process's address space
   popcli();
 }
 
+// Flush the TLB entries of pgdir, whose PTEs the caller has
+// just changed, on every CPU that may hold them: this one, and
+// any with pgdir loaded, which gets an interrupt. That includes
+// a CPU whose scheduler kept it loaded between two threads.
+// Returns when all have flushed, so that a page unmapped before
+// the call can be freed after it. The caller must have
+// interrupts on, or two CPUs could wait for each other. The
+// callers are system calls (munmap(), sbrk(), fork()) and
+// pagefault(), which trap() calls only for code that had
+// interrupts on; none holds a spin lock, and the swapper does
+// not flush (see uvmevict()).
+void
+uvmflush(pde_t *pgdir)
+{
+  struct cpu *c;
+  uint seen[NCPU];
+  int i, n, sent[NCPU];
+
+  if(!(readeflags() & FL_IF))
+    panic("uvmflush");
+  // The PTE changes must be visible before the looks at which
+  // page table each CPU has; one that loads pgdir later sets
+  // c->pgdir first, and loading cr3 flushes its TLB.
+  __sync_synchronize();
+  pushcli();
+  if(rcr3() == V2P(pgdir))
+    lcr3(V2P(pgdir));
+  n = 0;
+  for(i = 0; i < ncpu; i++){
+    c = &cpus[i];
+    sent[i] = 0;
+    if(c == mycpu() || c->pgdir != pgdir)
+      continue;
+    seen[i] = c->tlbflushes;
+    lapicipi(c->apicid, T_IRQ0 + IRQ_TLB);
+    sent[i] = 1;
+    n++;
+  }
+  popcli();
+  if(n == 0)
+    return;
+  for(i = 0; i < ncpu; i++)
+    while(sent[i] && cpus[i].tlbflushes == seen[i])
+      ;
+}
+
 // Load the initcode into address 0 of pgdir.
 // sz must be less than a page.
 void
@@ -192,30 +322,6 @@ inituvm(pde_t *pgdir, char *init, uint sz)
   memmove(mem, init, sz);
 }
 
-// Load a program segment into pgdir.  addr must be page-aligned
-// and the pages from addr to addr+sz must already be mapped.
-int
-loaduvm(pde_t *pgdir, char *addr, struct inode *ip, uint offset, uint sz)
-{
-  uint i, pa, n;
-  pte_t *pte;
-
-  if((uint) addr % PGSIZE != 0)
-    panic("loaduvm: addr must be page aligned");
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, addr+i, 0)) == 0)
-      panic("loaduvm: address should exist");
-    pa = PTE_ADDR(*pte);
-    if(sz - i < PGSIZE)
-      n = sz - i;
-    else
-      n = PGSIZE;
-    if(readi(ip, P2V(pa), offset+i, n) != n)
-      return -1;
-  }
-  return 0;
-}
-
 // Allocate page tables and physical memory to grow process from oldsz to
 // newsz, which need not be page aligned.  Returns new size or 0 on error.
 int
@@ -248,21 +354,112 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Like allocuvm, but map every new page to zeropage, so that
+// growing costs no memory until the pages are written.
+// Returns new size or 0 on error.
+int
+zerouvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  uint a;
+
+  if(newsz >= KERNBASE)
+    return 0;
+  if(newsz < oldsz)
+    return oldsz;
+
+  for(a = PGROUNDUP(oldsz); a < newsz; a += PGSIZE){
+    if(mappages(pgdir, (char*)a, PGSIZE, V2P(zeropage), PTE_U|PTE_ZERO) < 0){
+      cprintf("zerouvm out of memory\n");
+      deallocuvm(pgdir, newsz, oldsz);
+      return 0;
+    }
+  }
+  return newsz;
+}
+
+// Like allocuvm, but back each 4-Mbyte aligned stretch of the new
+// memory with a superpage when one is available, for processes
+// that asked for them with superpages(). Returns new size or 0.
+int
+allocsuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  char *mem;
+  uint a, next;
+
+  if(newsz >= KERNBASE)
+    return 0;
+  if(newsz < oldsz)
+    return oldsz;
+
+  a = PGROUNDUP(oldsz);
+  while(a < newsz){
+    next = SUPERPGROUNDUP(a + 1);
+    if(pgdir[PDX(a)] & PTE_PS){
+      // Still mapped from before the process last shrank.
+      a = next;
+      continue;
+    }
+    if(a % SUPERPGSIZE == 0 && newsz - a >= SUPERPGSIZE &&
+       !(pgdir[PDX(a)] & PTE_P) && (mem = ksuperalloc()) != 0){
+      memset(mem, 0, SUPERPGSIZE);
+      pgdir[PDX(a)] = V2P(mem) | PTE_P | PTE_W | PTE_U | PTE_PS;
+      a = next;
+      continue;
+    }
+    if(next > newsz)
+      next = newsz;
+    if(allocuvm(pgdir, a, next) == 0){
+      deallocuvm(pgdir, a, oldsz);
+      return 0;
+    }
+    a = PGROUNDUP(next);
+  }
+  return newsz;
+}
+
+static int deallocuvm1(pde_t*, uint, uint, int);
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
 // process size.  Returns the new process size.
+// A superpage is freed only once all of it lies above newsz;
+// until then it stays mapped in full. Pages are freed in
+// batches, each once no TLB maps it (uvmflush()), since other
+// threads may be running on pgdir.
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  return deallocuvm1(pgdir, oldsz, newsz, 1);
+}
+
+// deallocuvm(), flushing TLBs first if flush. freevm() does not:
+// no CPU has the page table it frees loaded.
+static int
+deallocuvm1(pde_t *pgdir, uint oldsz, uint newsz, int flush)
 {
   pte_t *pte;
   uint a, pa;
+  char *freed[32];
+  int i, n;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  n = 0;
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      if(a % SUPERPGSIZE == 0){
+        pa = PTE_ADDR(pgdir[PDX(a)]);
+        pgdir[PDX(a)] = 0;
+        if(flush)
+          uvmflush(pgdir);
+        ksuperfree(P2V(pa));
+      }
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -271,15 +468,32 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if(pa == 0)
         panic("kfree");
       char *v = P2V(pa);
-      kfree(v);
+      *pte = 0;
+      if(v != zeropage)
+        freed[n++] = v;
+      if(n == NELEM(freed)){
+        if(flush)
+          uvmflush(pgdir);
+        for(i = 0; i < n; i++)
+          kfree(freed[i]);
+        n = 0;
+      }
+    } else if(*pte & PTE_SWAP){
+      swapput(PTE_ADDR(*pte) / PGSIZE);
       *pte = 0;
     }
   }
+  if(n > 0 && flush)
+    uvmflush(pgdir);
+  for(i = 0; i < n; i++)
+    kfree(freed[i]);
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part. The kernel part is shared with kpgdir.
+// No CPU may have the page table loaded; wait() frees it
+// with ptable.lock held, so without a TLB flush.
 void
 freevm(pde_t *pgdir)
 {
@@ -287,8 +501,8 @@ freevm(pde_t *pgdir)
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
-  deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
+  deallocuvm1(pgdir, KERNBASE, 0, 0);
+  for(i = 0; i < PDX(KERNBASE); i++){
     if(pgdir[i] & PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
       kfree(v);
@@ -297,38 +511,64 @@ freevm(pde_t *pgdir)
   kfree((char*)pgdir);
 }
 
-// Clear PTE_U on a page. Used to create an inaccessible
-// page beneath the user stack.
-void
-clearpteu(pde_t *pgdir, char *uva)
-{
-  pte_t *pte;
-
-  pte = walkpgdir(pgdir, uva, 0);
-  if(pte == 0)
-    panic("clearpteu");
-  *pte &= ~PTE_U;
-}
-
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child. Pages that have not been faulted in
+// yet are left for the child to fault in itself, read-only
+// pages are shared rather than copied, and so are the swap
+// slots of swapped-out pages.
 pde_t*
 copyuvm(pde_t *pgdir, uint sz)
 {
   pde_t *d;
-  pte_t *pte;
-  uint pa, i, flags;
+  pte_t *pte, *cpte;
+  uint pa, i, j, flags;
   char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
   for(i = 0; i < sz; i += PGSIZE){
+    if(pgdir[PDX(i)] & PTE_PS){
+      // Copy a superpage into a superpage if there is one
+      // to spare, otherwise into small pages.
+      pa = PTE_ADDR(pgdir[PDX(i)]);
+      if((mem = ksuperalloc()) != 0){
+        memmove(mem, P2V(pa), SUPERPGSIZE);
+        d[PDX(i)] = V2P(mem) | PTE_FLAGS(pgdir[PDX(i)]);
+      } else {
+        for(j = 0; j < SUPERPGSIZE && i + j < sz; j += PGSIZE){
+          if((mem = kalloc()) == 0)
+            goto bad;
+          memmove(mem, (char*)P2V(pa + j), PGSIZE);
+          if(mappages(d, (void*)(i + j), PGSIZE, V2P(mem),
+                      PTE_W|PTE_U) < 0){
+            kfree(mem);
+            goto bad;
+          }
+        }
+      }
+      i += SUPERPGSIZE - PGSIZE;
+      continue;
+    }
     if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+      continue;
+    if(*pte & PTE_SWAP){
+      if((cpte = walkpgdir(d, (void*)i, 1)) == 0)
+        goto bad;
+      swapdup(PTE_ADDR(*pte) / PGSIZE);
+      *cpte = *pte;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
+    if(!(flags & PTE_W)){
+      if(mappages(d, (void*)i, PGSIZE, pa, flags) < 0)
+        goto bad;
+      if(P2V(pa) != zeropage)
+        kincref(P2V(pa));
+      continue;
+    }
     if((mem = kalloc()) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
@@ -351,6 +591,12 @@ uva2ka(pde_t *pgdir, char *uva)
 {
   pte_t *pte;
 
+  if(pgdir[PDX(uva)] & PTE_PS){
+    if((pgdir[PDX(uva)] & PTE_U) == 0)
+      return 0;
+    return (char*)P2V(PTE_ADDR(pgdir[PDX(uva)])) +
+      ((uint)uva % SUPERPGSIZE);
+  }
   pte = walkpgdir(pgdir, uva, 0);
   if((*pte & PTE_P) == 0)
     return 0;
@@ -386,9 +632,744 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 }
 
 //PAGEBREAK!
-// Blank page.
-//PAGEBREAK!
-// Blank page.
+// Demand paging.
+//
+// exec() does not read a program into memory. It records each
+// ELF segment as a vma and lets the first access to each page
+// fault it in from the executable through the page cache
+// (pagecache.c), so all processes running a program share its
+// pages. Pages are mapped read-only until written, so fork()
+// can share them too; a write to a shared page gives the
+// writer a private copy.
+//
+// mmap() makes regions of the same kind (VMA_MMAP) from the
+// top of the user address space down. MAP_SHARED regions
+// (VMA_SHARED) are the exception to copy-on-write: their
+// pages are mapped writable in every process that shares
+// them, and dirty file pages go back to the file when the
+// region is unmapped. File pages are the page cache's, which
+// write() and read() use too while the file is mapped so
+// (see pagecache.c); a shared mapping covers the file only as
+// far as it went at mmap(), and pages past that are zeros of
+// its own. fork() fills in the untouched pages of a shared
+// zero-fill region, so that parent and child share them.
+
+struct {
+  struct spinlock lock;
+  struct vma vma[NVMA];
+} vmatable;
+
+// Threads share a page table, and take its lock to fault in
+// pages, unmap regions, or change the size, so that two never
+// map the same page and regions stay put during a fault. Page
+// tables whose addresses hash alike share a lock. The lock
+// comes before the log and inode locks; system calls fault in
+// their user memory before taking those (see uvmtouch()).
+static struct sleeplock vmlocks[NPROC];
+
+void
+vmainit(void)
+{
+  int i;
+
+  initlock(&vmatable.lock, "vmatable");
+  for(i = 0; i < NPROC; i++)
+    initsleeplock(&vmlocks[i], "vmlock");
+}
+
+// Take the lock of the address space of pgdir.
+void
+lockuvm(pde_t *pgdir)
+{
+  acquiresleep(&vmlocks[V2P(pgdir) / PGSIZE % NPROC]);
+}
+
+void
+unlockuvm(pde_t *pgdir)
+{
+  releasesleep(&vmlocks[V2P(pgdir) / PGSIZE % NPROC]);
+}
+
+// Return a free slot. Caller must hold vmatable.lock.
+static struct vma*
+vmaslot(void)
+{
+  struct vma *v;
+
+  for(v = vmatable.vma; v < &vmatable.vma[NVMA]; v++)
+    if(v->pgdir == 0)
+      return v;
+  return 0;
+}
+
+// Is v a region whose stores reach its file?
+static int
+vmashared(struct vma *v)
+{
+  return v->ip && (v->flags & (VMA_SHARED|VMA_WRITE)) == (VMA_SHARED|VMA_WRITE);
+}
+
+// Take new references to the file and segment behind v, which
+// has just been copied into a new slot.
+// Caller must hold vmatable.lock.
+static void
+vmadup(struct vma *v)
+{
+  if(v->ip)
+    idup(v->ip);
+  if(vmashared(v))
+    v->ip->nshared++;
+  if(v->shm)
+    shmdup(v->shm);
+}
+
+// Free slot v and drop its references. Caller must hold
+// vmatable.lock, which is released while dropping them.
+static void
+vmafree(struct vma *v)
+{
+  struct inode *ip;
+  struct shm *shm;
+
+  ip = v->ip;
+  shm = v->shm;
+  if(vmashared(v))
+    ip->nshared--;
+  v->pgdir = 0;
+  v->ip = 0;
+  v->shm = 0;
+  if(ip || shm){
+    release(&vmatable.lock);
+    if(ip)
+      iput(ip);
+    if(shm)
+      shmput(shm);
+    acquire(&vmatable.lock);
+  }
+}
+
+// Record that [start, end) of pgdir is backed by ip at off
+// (for filesz bytes, then zeros). Takes a new reference to ip.
+// Returns 0 on success, -1 if the table is full.
+int
+vmaalloc(pde_t *pgdir, uint start, uint end, int flags,
+         struct inode *ip, uint off, uint filesz)
+{
+  struct vma *v;
+
+  if(start % PGSIZE != 0 || end <= start)
+    panic("vmaalloc");
+  acquire(&vmatable.lock);
+  if((v = vmaslot()) == 0){
+    release(&vmatable.lock);
+    return -1;
+  }
+  v->pgdir = pgdir;
+  v->start = start;
+  v->end = end;
+  v->flags = flags;
+  v->ip = ip ? idup(ip) : 0;
+  v->shm = 0;
+  v->off = off;
+  v->filesz = filesz;
+  release(&vmatable.lock);
+  return 0;
+}
+
+// Map the present pages of mmap() region v of from into to as
+// well. Shared regions share the pages outright; private ones
+// share them read-only, for copy-on-write. A shared zero-fill
+// region has its other pages filled in first, since parent and
+// child would each fault in their own.
+// Caller must hold vmatable.lock.
+static int
+vmacopypages(struct vma *v, pde_t *from, pde_t *to)
+{
+  pte_t *pte, *cpte;
+  uint a;
+  int fill;
+  char *mem;
+
+  fill = (v->flags & VMA_SHARED) && v->ip == 0 && v->shm == 0;
+  for(a = v->start; a < v->end; a += PGSIZE){
+    if((pte = walkpgdir(from, (char*)a, fill)) == 0){
+      if(fill)
+        return -1;
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(!(*pte & PTE_P) && fill){
+      if((mem = kalloc()) == 0)
+        return -1;
+      memset(mem, 0, PGSIZE);
+      *pte = V2P(mem) | PTE_P | PTE_U;
+    }
+    if(!(*pte & PTE_P))
+      continue;
+    if((cpte = walkpgdir(to, (char*)a, 1)) == 0)
+      return -1;
+    if(!(v->flags & VMA_SHARED))
+      *pte &= ~PTE_W;
+    // The child did not dirty the page; don't write it back twice.
+    *cpte = *pte & ~PTE_D;
+    if(P2V(PTE_ADDR(*pte)) != zeropage)
+      kincref(P2V(PTE_ADDR(*pte)));
+  }
+  return 0;
+}
+
+// Copy the regions of from into to, for a child whose page
+// table was made by copyuvm(), along with the pages of mmap()
+// regions, which copyuvm() leaves alone. from must be the
+// current page table. Returns 0 on success, -1 if out of
+// memory or the table is full (the caller then calls
+// vmaclear(to)).
+int
+vmacopy(pde_t *from, pde_t *to)
+{
+  struct vma *v, *nv;
+  int err;
+
+  err = 0;
+  acquire(&vmatable.lock);
+  nv = vmatable.vma;
+  for(v = vmatable.vma; v < &vmatable.vma[NVMA]; v++){
+    if(v->pgdir != from)
+      continue;
+    for(; nv < &vmatable.vma[NVMA] && nv->pgdir != 0; nv++)
+      ;
+    if(nv == &vmatable.vma[NVMA]){
+      err = -1;
+      break;
+    }
+    *nv = *v;
+    nv->pgdir = to;
+    vmadup(nv);
+    if((v->flags & VMA_MMAP) && vmacopypages(v, from, to) < 0){
+      err = -1;
+      break;
+    }
+  }
+  release(&vmatable.lock);
+  uvmflush(from);  // private pages became read-only
+  return err;
+}
+
+// Forget all regions of pgdir. Must be called before the page
+// directory itself is freed, and inside a transaction because
+// it may drop the last reference to an inode.
+void
+vmaclear(pde_t *pgdir)
+{
+  struct vma *v;
+
+  acquire(&vmatable.lock);
+  for(v = vmatable.vma; v < &vmatable.vma[NVMA]; v++)
+    if(v->pgdir == pgdir)
+      vmafree(v);
+  release(&vmatable.lock);
+}
+
+// Bring back the swapped-out page whose PTE is pte.
+static int
+uvmswapin(pte_t *pte)
+{
+  uint e;
+  char *mem;
+
+  e = *pte;
+  if((mem = kalloc()) == 0)
+    return -1;
+  swapin(PTE_ADDR(e) / PGSIZE, mem);
+  if(*pte != e){
+    // Another thread read it in while we slept.
+    kfree(mem);
+    return 0;
+  }
+  *pte = V2P(mem) | PTE_P | (e & (PTE_W|PTE_U));
+  swapput(PTE_ADDR(e) / PGSIZE);
+  return 0;
+}
+
+static int pagefault1(pde_t*, uint, uint);
+
+// Handle a page fault at user address va in the current process.
+// err is the processor's error code (FEC_*). Faults come from
+// user mode, or from uvmtouch() for memory the kernel is about
+// to use on the process's behalf. Returns 0 if the access can
+// now be retried, -1 if it is illegal. Threads of a process
+// fault one at a time.
+int
+pagefault(uint va, uint err)
+{
+  pde_t *pgdir = myproc()->pgdir;
+  int r;
+
+  if(va >= KERNBASE)
+    return -1;
+  lockuvm(pgdir);
+  r = pagefault1(pgdir, PGROUNDDOWN(va), err);
+  unlockuvm(pgdir);
+  return r;
+}
+
+// Handle a fault at page a of pgdir, whose lock is held.
+static int
+pagefault1(pde_t *pgdir, uint a, uint err)
+{
+  struct proc *curproc = myproc();
+  struct vma *v, vcopy;
+  pte_t *pte;
+  uint e, pa, n;
+  char *mem, *cp;
+
+  if(!(pgdir[PDX(a)] & PTE_PS) &&
+     (pte = walkpgdir(pgdir, (char*)a, 0)) != 0){
+    if((*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U) &&
+       (!(err & FEC_WR) || (*pte & PTE_W))){
+      // Another thread dealt with the fault while this one
+      // waited for the lock, or after this CPU's TLB entry
+      // was made.
+      lcr3(V2P(pgdir));
+      return 0;
+    }
+    if(*pte & PTE_SWAP)
+      return uvmswapin(pte);
+    if((*pte & PTE_ZERO) && (err & FEC_WR)){
+      // First write to a zero page, whether heap or BSS. Other
+      // threads' TLBs may still map zeropage here.
+      if((mem = kalloc()) == 0)
+        return -1;
+      memset(mem, 0, PGSIZE);
+      *pte = V2P(mem) | PTE_P | PTE_W | PTE_U;
+      uvmflush(pgdir);
+      return 0;
+    }
+  }
+
+  acquire(&vmatable.lock);
+  for(v = vmatable.vma; v < &vmatable.vma[NVMA]; v++)
+    if(v->pgdir == pgdir && a >= v->start && a < v->end &&
+       (a < curproc->sz || (v->flags & VMA_MMAP)))
+      break;
+  if(v == &vmatable.vma[NVMA]){
+    release(&vmatable.lock);
+    return -1;
+  }
+  // Regions change only with pgdir's lock held (munmapuvm()),
+  // or once no thread is left to fault (vmaclear()), so the copy
+  // and its inode stay valid after vmatable.lock is released.
+  vcopy = *v;
+  release(&vmatable.lock);
+  v = &vcopy;
+
+  if((err & FEC_WR) && !(v->flags & VMA_WRITE))
+    return -1;
+  if((pte = walkpgdir(pgdir, (char*)a, 1)) == 0)
+    return -1;
+
+  if(*pte & PTE_P){
+    // Write to a read-only page: copy it unless we are the
+    // only user or the region is shared, in which case it can
+    // simply become writable.
+    if(!(err & FEC_WR) || (*pte & PTE_W) || !(*pte & PTE_U))
+      return -1;
+    e = *pte;
+    pa = PTE_ADDR(e);
+    if(!(v->flags & VMA_SHARED) && krefcount(P2V(pa)) > 1){
+      if((mem = kalloc()) == 0)
+        return -1;
+      if(*pte != e){
+        // Swapped out while kalloc() slept, the other users
+        // having let go of it; fault again.
+        kfree(mem);
+        return 0;
+      }
+      memmove(mem, P2V(pa), PGSIZE);
+      *pte = V2P(mem) | PTE_FLAGS(e) | PTE_W;
+      uvmflush(pgdir);  // before the other users can reuse it
+      kfree(P2V(pa));
+      return 0;
+    }
+    *pte |= PTE_W;
+    lcr3(V2P(pgdir));
+    return 0;
+  }
+
+  if(v->shm){
+    // Shared memory: the segment's own page.
+    if((mem = shmpage(v->shm, (v->off + (a - v->start)) / PGSIZE)) == 0)
+      return -1;
+    *pte = V2P(mem) | PTE_P | PTE_U | ((err & FEC_WR) ? PTE_W : 0);
+    return 0;
+  }
+
+  if(a - v->start >= v->filesz){
+    // Nothing from the file. Reading a private region maps
+    // zeropage until the first write; shared regions need a
+    // page that all the sharers will see.
+    if(!(err & FEC_WR) && !(v->flags & VMA_SHARED)){
+      *pte = V2P(zeropage) | PTE_P | PTE_U |
+        ((v->flags & VMA_WRITE) ? PTE_ZERO : 0);
+      return 0;
+    }
+    if((mem = kalloc()) == 0)
+      return -1;
+    memset(mem, 0, PGSIZE);
+    *pte = V2P(mem) | PTE_P | PTE_U | ((err & FEC_WR) ? PTE_W : 0);
+    return 0;
+  }
+
+  // File contents come from the page cache and are shared
+  // read-only; a write fault takes a private copy at once.
+  // Shared regions map the cached page itself.
+  n = v->filesz - (a - v->start);
+  if(n > PGSIZE)
+    n = PGSIZE;
+  if((mem = pcget(v->ip, v->off + (a - v->start), n,
+                  v->flags & VMA_SHARED)) == 0)
+    return -1;
+  if(v->flags & VMA_SHARED){
+    *pte = V2P(mem) | PTE_P | PTE_U | ((err & FEC_WR) ? PTE_W : 0);
+    return 0;
+  }
+  if(err & FEC_WR){
+    if((cp = kalloc()) == 0){
+      kfree(mem);
+      return -1;
+    }
+    memmove(cp, mem, PGSIZE);
+    kfree(mem);
+    *pte = V2P(cp) | PTE_P | PTE_U | PTE_W;
+    return 0;
+  }
+  // pcget() may have slept, but other threads' faults wait for
+  // pgdir's lock, so nothing else can have mapped the page.
+  *pte = V2P(mem) | PTE_P | PTE_U;
+  return 0;
+}
+
+// Fault in any missing pages of the current process in
+// [va, va+len) so that the kernel can copy to and from them
+// later with ucopy() without sleeping, e.g. while holding a
+// spinlock in pipewrite() or consolewrite(). If write, also
+// make them writable, copying shared pages now rather than
+// when the kernel writes them.
+// Returns 0 on success, -1 on a bad address.
+int
+uvmtouch(uint va, uint len, int write)
+{
+  pde_t *pgdir = myproc()->pgdir;
+  pte_t *pte;
+  uint a, last, err;
+
+  if(len == 0)
+    return 0;
+  err = write ? FEC_WR : 0;
+  a = PGROUNDDOWN(va);
+  last = PGROUNDDOWN(va + len - 1);
+  for(;;){
+    if(pgdir[PDX(a)] & PTE_PS)
+      pte = &pgdir[PDX(a)];
+    else
+      pte = walkpgdir(pgdir, (char*)a, 0);
+    if(pte == 0 || !(*pte & PTE_P) || (write && !(*pte & PTE_W)))
+      if(pagefault(a, err) < 0)
+        return -1;
+    if(a == last)
+      break;
+    a += PGSIZE;
+  }
+  return 0;
+}
+
+// Look for a page of pgdir below sz to swap out to slot,
+// starting at *va: a clock, in which a page with PTE_A set
+// has the bit cleared and is passed over until next time.
+// Only private pages with no other reference qualify. If one
+// is found, point its PTE at slot and return the page, with
+// *va just past it; otherwise return 0 with *va at sz.
+// Caller must hold ptable.lock, and no CPU may be using pgdir,
+// so no TLB holds the PTE.
+char*
+uvmevict(pde_t *pgdir, uint sz, uint *va, uint slot)
+{
+  pte_t *pte;
+  uint a, pa;
+
+  for(a = *va; a < sz; a += PGSIZE){
+    if((pgdir[PDX(a)] & PTE_PS) ||
+       (pte = walkpgdir(pgdir, (char*)a, 0)) == 0){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U))
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    pa = PTE_ADDR(*pte);
+    if(P2V(pa) == zeropage || krefcount(P2V(pa)) != 1)
+      continue;
+    *pte = slot*PGSIZE | PTE_SWAP | (*pte & (PTE_W|PTE_U));
+    *va = a + PGSIZE;
+    return P2V(pa);
+  }
+  *va = sz;
+  return 0;
+}
+
+// Count the pages held by the user part of pgdir into pm:
+// resident pages, those of them with another reference (shared
+// with a fork or a mapping), pages still mapped to zeropage,
+// pages in swap, and page table pages including the directory.
+// Caller must hold ptable.lock, so pgdir cannot be freed.
+void
+uvmstat(pde_t *pgdir, struct procmem *pm)
+{
+  pte_t *pt;
+  uint i, j;
+  char *v;
+
+  pm->rss = pm->shared = pm->zero = pm->swapped = 0;
+  pm->ptpages = 1;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    if(pgdir[i] & PTE_PS){
+      pm->rss += NPTENTRIES;
+      continue;
+    }
+    pm->ptpages++;
+    pt = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pt[j] & PTE_P){
+        v = P2V(PTE_ADDR(pt[j]));
+        if(v == zeropage)
+          pm->zero++;
+        else {
+          pm->rss++;
+          if(krefcount(v) > 1)
+            pm->shared++;
+        }
+      } else if(pt[j] & PTE_SWAP)
+        pm->swapped++;
+    }
+  }
+}
+
+// Map len bytes of ip starting at off, or of shared-memory
+// segment shm, or zeros if both are 0, into the current
+// process at the highest free address below MMAPTOP.
+// flags are VMA_*. Returns the address, or -1.
+int
+mmapuvm(struct inode *ip, struct shm *shm, uint off, uint len, int flags)
+{
+  struct proc *curproc = myproc();
+  pde_t *pgdir = curproc->pgdir;
+  struct vma *v;
+  uint start, filesz;
+
+  len = PGROUNDUP(len);
+  if(len == 0 || len > MMAPTOP)
+    return -1;
+  filesz = 0;
+  if(ip){
+    ilock(ip);
+    if(ip->type != T_FILE){
+      iunlock(ip);
+      return -1;
+    }
+    if(off < ip->size)
+      filesz = ip->size - off;
+    iunlock(ip);
+    if(filesz > len)
+      filesz = len;
+  }
+
+  acquire(&vmatable.lock);
+  start = MMAPTOP - len;
+  for(v = vmatable.vma; v < &vmatable.vma[NVMA]; ){
+    if(v->pgdir == pgdir && v->start < start + len && start < v->end){
+      // Overlap: try just below v, and start over.
+      if(v->start < len)
+        break;
+      start = v->start - len;
+      v = vmatable.vma;
+      continue;
+    }
+    v++;
+  }
+  // Keep clear of the heap, including the rest of any superpage.
+  if(v != &vmatable.vma[NVMA] || start < SUPERPGROUNDUP(curproc->sz) ||
+     (v = vmaslot()) == 0){
+    release(&vmatable.lock);
+    return -1;
+  }
+  v->pgdir = pgdir;
+  v->start = start;
+  v->end = start + len;
+  v->flags = flags | VMA_MMAP;
+  v->ip = ip;
+  v->shm = shm;
+  vmadup(v);
+  v->off = off;
+  v->filesz = filesz;
+  release(&vmatable.lock);
+  return start;
+}
+
+// Does [start, end) of pgdir overlap an mmap() region?
+// growproc() must not grow the heap into one.
+int
+vmammapped(pde_t *pgdir, uint start, uint end)
+{
+  struct vma *v;
+  int found;
+
+  found = 0;
+  acquire(&vmatable.lock);
+  for(v = vmatable.vma; v < &vmatable.vma[NVMA]; v++)
+    if(v->pgdir == pgdir && (v->flags & VMA_MMAP) &&
+       v->start < end && start < v->end)
+      found = 1;
+  release(&vmatable.lock);
+  return found;
+}
+
+// Write the dirty pages of shared file regions of pgdir that
+// lie in [lo, hi) back to their files. Like filewrite(), it
+// splits the writes into transactions small enough for the
+// log, so the caller must not be in a transaction.
+void
+vmawriteback(pde_t *pgdir, uint lo, uint hi)
+{
+  struct vma v;
+  pte_t *pte;
+  uint a, i, n, n1, max;
+  int slot;
+
+  max = ((MAXOPBLOCKS-1-1-2) / 2) * BSIZE;
+  for(slot = 0; slot < NVMA; slot++){
+    // The caller holds pgdir's lock or is the last thread using
+    // it, so the regions cannot change while writing.
+    acquire(&vmatable.lock);
+    v = vmatable.vma[slot];
+    release(&vmatable.lock);
+    if(v.pgdir != pgdir || v.ip == 0 ||
+       (v.flags & (VMA_SHARED|VMA_WRITE)) != (VMA_SHARED|VMA_WRITE))
+      continue;
+    for(a = v.start; a < v.end && a - v.start < v.filesz; a += PGSIZE){
+      if(a < lo || a >= hi)
+        continue;
+      pte = walkpgdir(pgdir, (char*)a, 0);
+      if(pte == 0 || (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+        continue;
+      n = v.filesz - (a - v.start);
+      if(n > PGSIZE)
+        n = PGSIZE;
+      for(i = 0; i < n; i += n1){
+        n1 = n - i;
+        if(n1 > max)
+          n1 = max;
+        begin_op();
+        ilock(v.ip);
+        writei(v.ip, (char*)P2V(PTE_ADDR(*pte)) + i,
+               v.off + (a - v.start) + i, n1);
+        iunlock(v.ip);
+        end_op();
+      }
+    }
+  }
+}
+
+// Detach the shared-memory segment that shmat() mapped at addr.
+int
+shmdetach(uint addr)
+{
+  pde_t *pgdir = myproc()->pgdir;
+  struct vma *v;
+  uint len;
+
+  acquire(&vmatable.lock);
+  for(v = vmatable.vma; v < &vmatable.vma[NVMA]; v++)
+    if(v->pgdir == pgdir && v->shm && v->start == addr)
+      break;
+  if(v == &vmatable.vma[NVMA]){
+    release(&vmatable.lock);
+    return -1;
+  }
+  len = v->end - v->start;
+  release(&vmatable.lock);
+  return munmapuvm(addr, len);
+}
+
+// Remove the parts of the current process's mmap() regions
+// that lie in [addr, addr+len), writing dirty shared pages
+// back first. Returns 0 on success, -1 on a bad range.
+int
+munmapuvm(uint addr, uint len)
+{
+  pde_t *pgdir = myproc()->pgdir;
+  struct vma *v, *nv;
+  uint end, lo, hi;
+
+  end = PGROUNDUP(addr + len);
+  if(addr % PGSIZE != 0 || len == 0 || end > MMAPTOP || end < addr)
+    return -1;
+
+  lockuvm(pgdir);
+  vmawriteback(pgdir, addr, end);
+
+  // One region at a time, freeing its pages without the lock:
+  // a region done no longer overlaps [addr, end).
+  begin_op();
+  for(;;){
+    acquire(&vmatable.lock);
+    for(v = vmatable.vma; v < &vmatable.vma[NVMA]; v++)
+      if(v->pgdir == pgdir && (v->flags & VMA_MMAP) &&
+         v->start < end && addr < v->end)
+        break;
+    if(v == &vmatable.vma[NVMA]){
+      release(&vmatable.lock);
+      break;
+    }
+    lo = addr > v->start ? addr : v->start;
+    hi = end < v->end ? end : v->end;
+    if(lo > v->start && hi < v->end){
+      // A hole in the middle: the part above it needs a slot.
+      if((nv = vmaslot()) == 0){
+        release(&vmatable.lock);
+        end_op();
+        unlockuvm(pgdir);
+        return -1;
+      }
+      *nv = *v;
+      nv->start = hi;
+      nv->off += hi - v->start;
+      nv->filesz = v->filesz > hi - v->start ? v->filesz - (hi - v->start) : 0;
+      vmadup(nv);
+      v->end = lo;
+    } else if(lo > v->start){
+      v->end = lo;
+    } else if(hi < v->end){
+      v->off += hi - v->start;
+      v->filesz = v->filesz > hi - v->start ? v->filesz - (hi - v->start) : 0;
+      v->start = hi;
+    } else {
+      vmafree(v);
+    }
+    if(v->filesz > v->end - v->start && v->pgdir)
+      v->filesz = v->end - v->start;
+    release(&vmatable.lock);
+    deallocuvm(pgdir, hi, lo);
+  }
+  end_op();
+  unlockuvm(pgdir);
+  return 0;
+}
+
 //PAGEBREAK!
 // Blank page.
 
@@ -0,0 +1,19 @@
+// A region of a user address space whose pages are filled in
+// on demand by pagefault() in vm.c rather than when the region
+// is created. Regions belong to a page directory, not a process,
+// and live in a single table (vmatable) like open files do.
+struct vma {
+  pde_t *pgdir;       // address space, or 0 if this slot is free
+  uint start;         // first virtual address (page aligned)
+  uint end;           // one past the last virtual address
+  int flags;          // VMA_* below
+  struct inode *ip;   // backing file (referenced), or 0 for zero-fill
+  struct shm *shm;    // or shared-memory segment (referenced), see shm.c
+  uint off;           // file offset corresponding to start
+  uint filesz;        // bytes of [start, end) backed by ip; rest reads as 0
+};
+
+#define VMA_WRITE  0x1   // user may write; private regions copy shared pages
+#define VMA_SHARED 0x2   // pages are shared, never copied; dirty file
+                         // pages are written back by vmawriteback()
+#define VMA_MMAP   0x4   // made by mmap(), above the process size
@@ -0,0 +1,107 @@
+// Zero-fill-on-demand benchmark.
+//
+//   zerobench [n]
+//
+// Times n runs of a child with a 4-Mbyte BSS that reads all of
+// it, then n that write all of it, reporting the pages each
+// kind of child uses; reads map the shared zero page, writes
+// need pages of their own. Then does the same with 4 Mbytes
+// of heap from sbrk().
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define BIG (4*1024*1024)
+
+char bss[BIG];
+
+// Touch every page of p, writing if w, and report the free
+// pages then through fd.
+void
+touch(char *p, int w, int fd)
+{
+  struct meminfo mi;
+  int i, sum;
+
+  sum = 0;
+  for(i = 0; i < BIG; i += 4096){
+    if(w)
+      p[i] = 1;
+    else
+      sum += p[i];
+  }
+  if(sum != 0)
+    printf(2, "zerobench: memory not zero\n");
+  meminfo(&mi);
+  write(fd, &mi.freepages, sizeof(mi.freepages));
+}
+
+// Run n children that touch BIG bytes of BSS or heap; print
+// the ticks taken and the pages each child used.
+void
+run(int n, int heap, int write)
+{
+  char *argv[] = { "zerobench", "child", "b", "r", 0 };
+  int i, t0, t1, fds[2];
+  uint before, after, used;
+  struct meminfo mi;
+
+  argv[2] = heap ? "h" : "b";
+  argv[3] = write ? "w" : "r";
+  used = 0;
+  t0 = uptime();
+  for(i = 0; i < n; i++){
+    if(pipe(fds) < 0){
+      printf(2, "zerobench: pipe failed\n");
+      exit();
+    }
+    meminfo(&mi);
+    before = mi.freepages;
+    if(fork() == 0){
+      close(fds[0]);
+      if(fds[1] != 3){
+        close(3);
+        dup(fds[1]);
+      }
+      exec("zerobench", argv);
+      printf(2, "zerobench: exec failed\n");
+      exit();
+    }
+    close(fds[1]);
+    if(read(fds[0], &after, sizeof(after)) == sizeof(after))
+      used = before - after;
+    close(fds[0]);
+    wait();
+  }
+  t1 = uptime();
+  printf(1, "%s %s: %d runs in %d ticks, %d pages each\n",
+         heap ? "heap" : "bss", write ? "write" : "read", n, t1 - t0, used);
+}
+
+int
+main(int argc, char *argv[])
+{
+  int n;
+  char *p;
+
+  if(argc == 4 && strcmp(argv[1], "child") == 0){
+    // The pipe to the parent is on fd 3.
+    if(argv[2][0] == 'h'){
+      if((p = sbrk(BIG)) == (char*)-1){
+        printf(2, "zerobench: sbrk failed\n");
+        exit();
+      }
+    } else
+      p = bss;
+    touch(p, argv[3][0] == 'w', 3);
+    exit();
+  }
+  n = argc >= 2 ? atoi(argv[1]) : 20;
+  run(n, 0, 0);
+  run(n, 0, 1);
+  run(n, 1, 0);
+  run(n, 1, 1);
+  exit();
+}